@@ -0,0 +1,482 @@
+/*
+ * On-target cycle benchmarks for the perception kernels
+ *
+ * Each benchmark times a kernel against a reference version
+ * on a live camera frame using the DWT cycle counter, and
+ * prints both cycle counts and the largest output difference
+ * over UART0. Enable with BENCHMARK in main.c.
+ *
+ * File:    benchmark.c
+ * Authors: Seth Deane & Brian Powers
+ * Created: April 8 2019
+ */
+
+#include "MK64F12.h"
+#include "camera.h"
+#include "common.h"
+#include "filters.h"
+#include "pid.h"
+#include "benchmark.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+// Number of pixels in a line
+#define PIXELS              128
+
+// Runs averaged per measurement
+#define BENCH_RUNS          16
+
+// Char array for building the report
+static char bench_str[100];
+
+/* bench_report
+* Description:
+*   Prints one benchmark result
+*
+* Parameters:
+*   name - kernel name
+*   ref_cycles - cycles per run of the reference version
+*   new_cycles - cycles per run of the current version
+*   max_diff - largest output difference between the two
+*
+* Returns:
+*   void
+*/
+static void bench_report(char* name, uint32_t ref_cycles, uint32_t new_cycles, int max_diff) {
+    sprintf(bench_str, "%s: ref %lu, new %lu cycles, max diff %d\n\r", \
+            name, (unsigned long) ref_cycles, (unsigned long) new_cycles, max_diff);
+    put(bench_str);
+}
+
+/* convolve_double
+* Description:
+*   Reference convolve, the original double precision
+*   version (with the filter read kept in bounds)
+*/
+static void convolve_double(uint16_t *x, int16_t *h, uint16_t *y, int xSize, int hSize, int correction) {
+    for (int i=(hSize-1);i <  xSize; i++)
+    {
+        double sum = 0.0;
+        for (int j=hSize-1; j >=0; j--)
+        {
+            sum += h[j] * x[i-j];
+        }
+        y[i] = sum / correction;
+    }
+}
+
+/* der_convolve_double
+* Description:
+*   Reference der_convolve, the original double precision
+*   version (with the filter read kept in bounds)
+*/
+static void der_convolve_double(uint16_t *x, int16_t *h, int16_t *y, int xSize, int hSize, int correction) {
+    for (int i=(hSize-1);i <  xSize; i++)
+    {
+        double sum = 0.0;
+        for (int j=hSize-1; j >=0; j--)
+        {
+            sum += h[j] * x[i-j];
+        }
+        y[i] = sum / correction;
+    }
+}
+
+/* bench_convolve
+* Description:
+*   Integer convolve/der_convolve against the double
+*   precision originals, with the filter_main kernels
+*
+* Parameters:
+*   line - camera line
+*
+* Returns:
+*   void
+*/
+static void bench_convolve(uint16_t* line) {
+    int16_t weight_fil[5] = {1,2,4,2,1};
+    int16_t deriv_fil[3] = {1,0,-1};
+    static uint16_t ref_u[PIXELS], new_u[PIXELS];
+    static int16_t ref_s[PIXELS], new_s[PIXELS];
+    uint32_t start, ref_cycles, new_cycles;
+    int max_diff;
+
+    start = cycle_count();
+    for (int n = 0; n < BENCH_RUNS; n++) {
+        convolve_double(line, weight_fil, ref_u, PIXELS, 5, 10);
+    }
+    ref_cycles = (cycle_count() - start) / BENCH_RUNS;
+
+    start = cycle_count();
+    for (int n = 0; n < BENCH_RUNS; n++) {
+        convolve(line, weight_fil, new_u, PIXELS, 5, 10);
+    }
+    new_cycles = (cycle_count() - start) / BENCH_RUNS;
+
+    max_diff = 0;
+    for (int i = 4; i < PIXELS; i++) {
+        if (abs(ref_u[i] - new_u[i]) > max_diff) {
+            max_diff = abs(ref_u[i] - new_u[i]);
+        }
+    }
+    bench_report("convolve", ref_cycles, new_cycles, max_diff);
+
+    start = cycle_count();
+    for (int n = 0; n < BENCH_RUNS; n++) {
+        der_convolve_double(new_u, deriv_fil, ref_s, PIXELS, 3, 1);
+    }
+    ref_cycles = (cycle_count() - start) / BENCH_RUNS;
+
+    start = cycle_count();
+    for (int n = 0; n < BENCH_RUNS; n++) {
+        der_convolve(new_u, deriv_fil, new_s, PIXELS, 3, 1);
+    }
+    new_cycles = (cycle_count() - start) / BENCH_RUNS;
+
+    max_diff = 0;
+    for (int i = 2; i < PIXELS; i++) {
+        if (abs(ref_s[i] - new_s[i]) > max_diff) {
+            max_diff = abs(ref_s[i] - new_s[i]);
+        }
+    }
+    bench_report("der_convolve", ref_cycles, new_cycles, max_diff);
+}
+
+/* filter_three_pass
+* Description:
+*   Reference filter chain, the original three pass
+*   filter_main (median, weighted average with the
+*   shift-by-2 fix-up, derivative)
+*/
+static void filter_three_pass(uint16_t* camera_sig, int16_t* deriv_sig) {
+    static uint16_t median_sig[PIXELS];
+    median_filter(camera_sig, median_sig, PIXELS);
+
+    int16_t weight_fil[5] = {1,2,4,2,1};
+    static uint16_t weight_sig[PIXELS];
+    convolve(median_sig, weight_fil, weight_sig, PIXELS, 5, 10);
+
+    for (int k = 2; k < PIXELS-2; k++){
+        weight_sig[k] = weight_sig[k+2];
+    }
+    weight_sig[0] = weight_sig[2];
+    weight_sig[1] = weight_sig[2];
+    weight_sig[126] = weight_sig[125];
+    weight_sig[127] = weight_sig[125];
+
+    int16_t deriv_fil[3] = {1,0,-1};
+    der_convolve(weight_sig, deriv_fil, deriv_sig, PIXELS, 3, 1);
+}
+
+/* bench_fused
+* Description:
+*   Single pass filter_fused against the three pass chain
+*
+* Parameters:
+*   line - camera line
+*
+* Returns:
+*   void
+*/
+static void bench_fused(uint16_t* line) {
+    static int16_t ref_s[PIXELS], new_s[PIXELS];
+    uint32_t start, ref_cycles, new_cycles;
+    int max_diff;
+
+    start = cycle_count();
+    for (int n = 0; n < BENCH_RUNS; n++) {
+        filter_three_pass(line, ref_s);
+    }
+    ref_cycles = (cycle_count() - start) / BENCH_RUNS;
+
+    start = cycle_count();
+    for (int n = 0; n < BENCH_RUNS; n++) {
+        filter_fused(line, new_s, PIXELS);
+    }
+    new_cycles = (cycle_count() - start) / BENCH_RUNS;
+
+    // the three pass chain never writes deriv_sig[0..1]
+    max_diff = 0;
+    for (int i = 2; i < PIXELS; i++) {
+        if (abs(ref_s[i] - new_s[i]) > max_diff) {
+            max_diff = abs(ref_s[i] - new_s[i]);
+        }
+    }
+    bench_report("filter_fused", ref_cycles, new_cycles, max_diff);
+}
+
+/* bench_simd
+* Description:
+*   DSP extension filter_fused_simd against the scalar
+*   filter_fused (must match bit for bit)
+*
+* Parameters:
+*   line - camera line
+*
+* Returns:
+*   void
+*/
+static void bench_simd(uint16_t* line) {
+    static int16_t ref_s[PIXELS], new_s[PIXELS];
+    uint32_t start, ref_cycles, new_cycles;
+    int max_diff;
+
+    start = cycle_count();
+    for (int n = 0; n < BENCH_RUNS; n++) {
+        filter_fused(line, ref_s, PIXELS);
+    }
+    ref_cycles = (cycle_count() - start) / BENCH_RUNS;
+
+    start = cycle_count();
+    for (int n = 0; n < BENCH_RUNS; n++) {
+        filter_fused_simd(line, new_s, PIXELS);
+    }
+    new_cycles = (cycle_count() - start) / BENCH_RUNS;
+
+    max_diff = 0;
+    for (int i = 0; i < PIXELS; i++) {
+        if (abs(ref_s[i] - new_s[i]) > max_diff) {
+            max_diff = abs(ref_s[i] - new_s[i]);
+        }
+    }
+    bench_report("filter_fused_simd", ref_cycles, new_cycles, max_diff);
+}
+
+/* median_sorted
+* Description:
+*   Reference median of any width, insertion sort of the
+*   window with the ends replicated
+*/
+static void median_sorted(uint16_t* x, uint16_t* y, int x_size, int width) {
+    uint16_t window[MEDIAN_MAX_WIDTH];
+    int half = width / 2;
+
+    for (int i = 0; i < x_size; i++) {
+        for (int j = 0; j < width; j++) {
+            int k = i + j - half;
+            uint16_t v = x[(k < 0) ? 0 : ((k >= x_size) ? x_size - 1 : k)];
+            int m = j;
+            while ((m > 0) && (window[m-1] > v)) {
+                window[m] = window[m-1];
+                m--;
+            }
+            window[m] = v;
+        }
+        y[i] = window[half];
+    }
+}
+
+/* bench_median
+* Description:
+*   Sorting network (5, 7, 9) and sliding histogram (9 and
+*   wider) medians against the insertion sort reference
+*
+* Parameters:
+*   line - camera line
+*
+* Returns:
+*   void
+*/
+static void bench_median(uint16_t* line) {
+    static uint16_t ref_u[PIXELS], new_u[PIXELS];
+    int widths[5] = {5, 7, 9, 15, 31};
+    char name[24];
+    uint32_t start, ref_cycles, new_cycles;
+    int max_diff;
+
+    for (int w = 0; w < 5; w++) {
+        int width = widths[w];
+
+        start = cycle_count();
+        for (int n = 0; n < BENCH_RUNS; n++) {
+            median_sorted(line, ref_u, PIXELS, width);
+        }
+        ref_cycles = (cycle_count() - start) / BENCH_RUNS;
+
+        start = cycle_count();
+        for (int n = 0; n < BENCH_RUNS; n++) {
+            median_filter_wide(line, new_u, PIXELS, width);
+        }
+        new_cycles = (cycle_count() - start) / BENCH_RUNS;
+
+        max_diff = 0;
+        for (int i = 0; i < PIXELS; i++) {
+            if (abs(ref_u[i] - new_u[i]) > max_diff) {
+                max_diff = abs(ref_u[i] - new_u[i]);
+            }
+        }
+        sprintf(name, "median_filter_wide %d", width);
+        bench_report(name, ref_cycles, new_cycles, max_diff);
+
+        // networks cover up to 9, time the histogram there too
+        if (width == 9) {
+            start = cycle_count();
+            for (int n = 0; n < BENCH_RUNS; n++) {
+                median_filter_hist(line, new_u, PIXELS, width);
+            }
+            new_cycles = (cycle_count() - start) / BENCH_RUNS;
+
+            max_diff = 0;
+            for (int i = 0; i < PIXELS; i++) {
+                if (abs(ref_u[i] - new_u[i]) > max_diff) {
+                    max_diff = abs(ref_u[i] - new_u[i]);
+                }
+            }
+            bench_report("median_filter_hist 9", ref_cycles, new_cycles, max_diff);
+        }
+    }
+}
+
+/* stats_pow
+* Description:
+*   Reference statistics, the original two pass
+*   left_right_index version (pow per pixel, double sqrt)
+*/
+static void stats_pow(int16_t* array, int* mean_out, int* stdev_out) {
+    int total = 0;
+    for (int i = 0; i < PIXELS; i++) {
+        total += array[i];
+    }
+    int mean = total / PIXELS;
+
+    int difference = 0;
+    for (int i = 0; i < PIXELS; i++) {
+        difference += pow((array[i] - mean), 2);
+    }
+
+    *mean_out = mean;
+    *stdev_out = sqrt(difference/(PIXELS - 1));
+}
+
+/* bench_stats
+* Description:
+*   Single pass integer signal_stats against the pow/sqrt
+*   version, on the filtered derivative of the line
+*
+* Parameters:
+*   line - camera line
+*
+* Returns:
+*   void
+*/
+static void bench_stats(uint16_t* line) {
+    static int16_t deriv[PIXELS];
+    int ref_mean, ref_stdev, new_mean, new_stdev;
+    uint32_t start, ref_cycles, new_cycles;
+
+    filter_fused(line, deriv, PIXELS);
+
+    start = cycle_count();
+    for (int n = 0; n < BENCH_RUNS; n++) {
+        stats_pow(deriv, &ref_mean, &ref_stdev);
+    }
+    ref_cycles = (cycle_count() - start) / BENCH_RUNS;
+
+    start = cycle_count();
+    for (int n = 0; n < BENCH_RUNS; n++) {
+        signal_stats(deriv, PIXELS, &new_mean, &new_stdev);
+    }
+    new_cycles = (cycle_count() - start) / BENCH_RUNS;
+
+    int max_diff = abs(ref_mean - new_mean);
+    if (abs(ref_stdev - new_stdev) > max_diff) {
+        max_diff = abs(ref_stdev - new_stdev);
+    }
+    bench_report("signal_stats", ref_cycles, new_cycles, max_diff);
+}
+
+/* pid_velocity_double
+* Description:
+*   Reference steering PID, the original velocity form in
+*   double precision (no clamp)
+*/
+static void pid_velocity_double(float* err, float* turn, int n) {
+    double turn_old = 64.0;
+    double err_old1 = 0.0;
+    double err_old2 = 0.0;
+
+    for (int i = 0; i < n; i++) {
+        double e = err[i];
+        double t = turn_old - 4.25 * (e - err_old1) - 0.0 * (e + err_old1) / 2 - \
+                   2.0 * (e - 2 * err_old1 + err_old2);
+        turn[i] = t;
+        turn_old = t;
+        err_old2 = err_old1;
+        err_old1 = e;
+    }
+}
+
+/* bench_pid
+* Description:
+*   Float Pid_Update against the double velocity form, one
+*   update per pixel with the line as error signal. The
+*   derivative filter is off and the errors stay clear of
+*   the clamp so both must agree (max diff in 1/1000 of
+*   servo_turn)
+*
+* Parameters:
+*   line - camera line
+*
+* Returns:
+*   void
+*/
+static void bench_pid(uint16_t* line) {
+    static float err[PIXELS], ref_t[PIXELS], new_t[PIXELS];
+    uint32_t start, ref_cycles, new_cycles;
+    Pid pid;
+    int max_diff;
+
+    // errors of up to +-4 pixels, starting at 0 like a run
+    for (int i = 0; i < PIXELS; i++) {
+        err[i] = (i == 0) ? 0.0f : ((float) line[i] - 32768.0f) / 8192.0f;
+    }
+
+    start = cycle_count();
+    for (int n = 0; n < BENCH_RUNS; n++) {
+        pid_velocity_double(err, ref_t, PIXELS);
+    }
+    ref_cycles = (cycle_count() - start) / (BENCH_RUNS * PIXELS);
+
+    start = cycle_count();
+    for (int n = 0; n < BENCH_RUNS; n++) {
+        Pid_Init(&pid, 4.25f, 0.0f, 2.0f * .01f, .01f, 0.0f, -64.0f, 64.0f);
+        for (int i = 0; i < PIXELS; i++) {
+            new_t[i] = 64.0f - Pid_Update(&pid, err[i]);
+        }
+    }
+    new_cycles = (cycle_count() - start) / (BENCH_RUNS * PIXELS);
+
+    max_diff = 0;
+    for (int i = 0; i < PIXELS; i++) {
+        int diff = (int) (1000.0f * (ref_t[i] - new_t[i]));
+        if (abs(diff) > max_diff) {
+            max_diff = abs(diff);
+        }
+    }
+    bench_report("pid per update", ref_cycles, new_cycles, max_diff);
+}
+
+/* Benchmark_Run
+* Description:
+*   Waits for a camera frame and runs every benchmark on it
+*
+* Parameters:
+*   void
+*
+* Returns:
+*   void
+*/
+void Benchmark_Run(void) {
+    CameraFrame frame;
+
+    Camera_WaitFrame(&frame);
+
+    put("\n\rBenchmarks (cycles per call)\n\r");
+    bench_convolve(frame.line);
+    bench_fused(frame.line);
+    bench_simd(frame.line);
+    bench_median(frame.line);
+    bench_stats(frame.line);
+    bench_pid(frame.line);
+}
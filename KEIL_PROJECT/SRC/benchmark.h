@@ -0,0 +1,4 @@
+#ifndef  BENCHMARK_H_
+#define  BENCHMARK_H_
+void Benchmark_Run(void);
+#endif  /*  ifndef  BENCHMARK_H_  */
@@ -0,0 +1,195 @@
+/*
+ * Per-pixel fixed-pattern-noise and vignetting correction
+ *
+ * A dark frame (lens covered) gives each pixel's offset and
+ * a flat frame (camera looking at the white track) gives
+ * its response, including the lens roll-off at both ends
+ * of the line. From these a gain table (Q12) and a bias
+ * table are built so the correction is a single integer
+ * multiply-add per pixel:
+ *
+ *   out = (in * gain - bias) >> 12,  bias = dark * gain
+ *
+ * Until a calibration is computed lines pass unchanged.
+ *
+ * File:    calibration.c
+ * Authors: Seth Deane & Brian Powers
+ * Created: April 6 2019
+ */
+
+#include "MK64F12.h"
+#include "camera.h"
+#include "calibration.h"
+
+// Number of pixels in a line
+#define PIXELS              128
+
+// Frames averaged per reference capture
+#define CAL_FRAMES          16
+
+// Gain format (Q12, 4096 = 1.0) and its limits. Pixels
+//  whose flat response is tiny would get huge gains, so
+//  the gain is clamped (8x covers the worst lens roll-off)
+#define GAIN_SHIFT          12
+#define GAIN_ONE            (1 << GAIN_SHIFT)
+#define GAIN_MAX            (8 * GAIN_ONE)
+
+// Averaged reference frames (per camera)
+static uint16_t dark[CAMERA_COUNT][PIXELS];
+static uint16_t flat[CAMERA_COUNT][PIXELS];
+
+// Correction tables (per camera)
+static uint16_t gain[CAMERA_COUNT][PIXELS];
+static int32_t bias[CAMERA_COUNT][PIXELS];
+static int calibrated = 0;
+
+/* Function: Calibration_Capture
+ * -----------------------------
+ *  Averages CAL_FRAMES new frames into the dark or flat
+ *  reference of every camera. Blocks for CAL_FRAMES
+ *  integration periods.
+ *
+ *  reference: CAL_DARK or CAL_FLAT
+ *
+ *  Returns: void
+ */
+void Calibration_Capture(int reference) {
+
+    static uint32_t sum[CAMERA_COUNT][PIXELS];
+    CameraFrame frame;
+
+    for (int c = 0; c < CAMERA_COUNT; c++) {
+        for (int i = 0; i < PIXELS; i++) {
+            sum[c][i] = 0;
+        }
+    }
+
+    for (int n = 0; n < CAL_FRAMES; n++) {
+        Camera_WaitFrame(&frame);
+        for (int c = 0; c < CAMERA_COUNT; c++) {
+            for (int i = 0; i < PIXELS; i++) {
+                sum[c][i] += frame.lines[c][i];
+            }
+        }
+    }
+
+    for (int c = 0; c < CAMERA_COUNT; c++) {
+        for (int i = 0; i < PIXELS; i++) {
+            uint16_t avg = sum[c][i] / CAL_FRAMES;
+            if (reference == CAL_DARK) {
+                dark[c][i] = avg;
+            } else {
+                flat[c][i] = avg;
+            }
+        }
+    }
+}
+
+/* Function: Calibration_Compute
+ * -----------------------------
+ *  Builds the gain/bias tables from the dark and flat
+ *  references. Every pixel is scaled so its flat response
+ *  matches the line's mean flat response, with the dark
+ *  level removed. The old tables are kept if the flat
+ *  frame is not brighter than the dark frame.
+ *
+ *  Returns: 1 if the tables were updated, 0 otherwise
+ */
+int Calibration_Compute(void) {
+
+    for (int c = 0; c < CAMERA_COUNT; c++) {
+        uint32_t total = 0;
+        for (int i = 0; i < PIXELS; i++) {
+            if (flat[c][i] > dark[c][i]) {
+                total += flat[c][i] - dark[c][i];
+            }
+        }
+        if (total < PIXELS) {
+            return 0;
+        }
+    }
+
+    for (int c = 0; c < CAMERA_COUNT; c++) {
+        uint32_t total = 0;
+        for (int i = 0; i < PIXELS; i++) {
+            if (flat[c][i] > dark[c][i]) {
+                total += flat[c][i] - dark[c][i];
+            }
+        }
+        uint32_t mean = total / PIXELS;
+
+        for (int i = 0; i < PIXELS; i++) {
+            uint32_t range = (flat[c][i] > dark[c][i]) ? flat[c][i] - dark[c][i] : 0;
+            uint32_t g = GAIN_MAX;
+            if (range > 0) {
+                g = (mean << GAIN_SHIFT) / range;
+                if (g > GAIN_MAX) {
+                    g = GAIN_MAX;
+                }
+            }
+            gain[c][i] = g;
+            bias[c][i] = (int32_t) dark[c][i] * (int32_t) g;
+        }
+    }
+
+    calibrated = 1;
+
+    return 1;
+}
+
+/* Function: Calibration_Pixel
+ * ---------------------------
+ *  Corrects a single sample, for use while a line is
+ *  still being captured (streaming filter mode).
+ *
+ *  value: raw camera value
+ *  pixel: pixel index (0..127)
+ *  camera: camera index (0 = near)
+ *
+ *  Returns: corrected value, clamped to 0..65535
+ */
+uint16_t Calibration_Pixel(uint16_t value, int pixel, int camera) {
+
+    if (!calibrated) {
+        return value;
+    }
+
+    int32_t out = ((int32_t) value * gain[camera][pixel] - bias[camera][pixel]) >> GAIN_SHIFT;
+    if (out < 0) {
+        out = 0;
+    } else if (out > 0xFFFF) {
+        out = 0xFFFF;
+    }
+    return out;
+}
+
+/* Function: Calibration_Apply
+ * ---------------------------
+ *  Corrects a line in place with the camera's gain/bias
+ *  tables. Results are clamped to 0..65535. Does nothing
+ *  until Calibration_Compute has succeeded.
+ *
+ *  line: 128 camera values
+ *  camera: camera index (0 = near)
+ *
+ *  Returns: void
+ */
+void Calibration_Apply(uint16_t* line, int camera) {
+
+    if (!calibrated) {
+        return;
+    }
+
+    uint16_t* g = gain[camera];
+    int32_t* b = bias[camera];
+
+    for (int i = 0; i < PIXELS; i++) {
+        int32_t value = ((int32_t) line[i] * g[i] - b[i]) >> GAIN_SHIFT;
+        if (value < 0) {
+            value = 0;
+        } else if (value > 0xFFFF) {
+            value = 0xFFFF;
+        }
+        line[i] = value;
+    }
+}
@@ -0,0 +1,12 @@
+#ifndef  CALIBRATION_H_
+#define  CALIBRATION_H_
+
+// Which reference Calibration_Capture records
+#define CAL_DARK    0
+#define CAL_FLAT    1
+
+void Calibration_Capture(int reference);
+int Calibration_Compute(void);
+void Calibration_Apply(uint16_t* line, int camera);
+uint16_t Calibration_Pixel(uint16_t value, int pixel, int camera);
+#endif  /*  ifndef  CALIBRATION_H_  */
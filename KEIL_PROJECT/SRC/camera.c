@@ -13,9 +13,37 @@
  *  generate the camera signals and read the camera
  *  output.
  *
- *  PTB9      - camera CLK
- *  PTB23     - camera SI
- *  ADC0_DP0  - camera AOut
+ *  With CAMERA_USE_DMA set, the per-edge interrupts are
+ *  replaced by eDMA. FTM2 runs one full camera clock per
+ *  period and its two channel matches request DMA writes
+ *  to GPIOB_PSOR/PCOR that raise and lower CLK (and drop
+ *  SI after the first pulse). The CH1 match also triggers
+ *  ADC0 and the conversion complete flag requests a DMA
+ *  transfer from ADC0_RA into line. The only interrupt
+ *  per line is the DMA0 major loop completion after the
+ *  129th clock.
+ *
+ *  Lines are captured into a ring of frame buffers. The
+ *  ISR fills one buffer while the control loop reads
+ *  another, and each completed line is published with a
+ *  sequence number and a cycle counter timestamp, so the
+ *  reader never sees a half written frame.
+ *
+ *  With CAMERA_STREAM_FILTER set (per-edge ISR capture
+ *  only) camera 0 samples are calibrated and pushed
+ *  through the median/average/derivative chain as they
+ *  arrive, so the derivative is published with the frame
+ *  a few microseconds after the last pixel.
+ *
+ *  CAMERA_COUNT (camera.h) selects one or two cameras.
+ *  Both share CLK and SI, camera 0 (near) is sampled by
+ *  ADC0 and camera 1 (far) by ADC1 on the same FTM2
+ *  trigger, so the two lines of a frame are time aligned.
+ *
+ *  PTB9      - camera CLK (all cameras)
+ *  PTB23     - camera SI (all cameras)
+ *  ADC0_DP0  - camera 0 AOut
+ *  ADC1_DP0  - camera 1 AOut
  *
  * File:    camera.c
  * Authors: Seth Deane & Brian Powers
@@ -25,6 +53,9 @@
 #include "MK64F12.h"
 #include "camera.h"
 #include "uart.h"
+#include "common.h"
+#include "filters.h"
+#include "calibration.h"
 #include <stdio.h>
 
 // Default System clock value
@@ -36,14 +67,82 @@
 // Must be above 1.25 ms based on camera clk
 //  (camera clk is the mod value set in FTM2)
 #define INTEGRATION_TIME .0075f
+// Limits for Camera_SetIntegration (seconds)
+// The minimum sits above the 1.25 ms sensor limit because
+//  a 129 clock readout takes ~2.6 ms and the next PIT0
+//  overflow must not restart a line still being read
+#define INTEGRATION_TIME_MIN .003f
+#define INTEGRATION_TIME_MAX .1f
+
+// Capture mode
+// 1 = FTM2/ADC0 hardware with eDMA, one interrupt per line
+// 0 = FTM2 overflow interrupt on every CLK edge
+#define CAMERA_USE_DMA 1
+
+// Streaming filter (1 = filter camera 0 in the capture ISR)
+// Needs a per-pixel interrupt, so only with CAMERA_USE_DMA 0
+#define CAMERA_STREAM_FILTER 0
+
+#if CAMERA_STREAM_FILTER && CAMERA_USE_DMA
+#error "CAMERA_STREAM_FILTER needs CAMERA_USE_DMA 0"
+#endif
+
+// Camera pins on port B
+#define CAM_CLK_MASK (1UL << 9)
+#define CAM_SI_MASK  (1UL << 23)
+
+// Number of pixels and clock pulses in one readout
+// (the 129th pulse terminates the sensor output)
+#define CAM_PIXELS 128
+#define CAM_CLOCKS 129
+
+// eDMA channels used for DMA capture
+// The CLK low channel is last to finish, so it owns the
+// line complete interrupt (DMA0_IRQHandler)
+#define CAM_DMA_CLK_LOW  0
+#define CAM_DMA_CLK_HIGH 1
+#define CAM_DMA_ADC0     2
+#define CAM_DMA_ADC1     3
+
+// Frame ring size (3 lets the ISR always find a buffer
+// that is neither being read nor waiting to be read)
+#define CAM_FRAME_BUFFERS 3
+
+// DMAMUX request sources (K64 reference manual table 3-24)
+#define DMAMUX_SRC_FTM2_CH0 30
+#define DMAMUX_SRC_FTM2_CH1 31
+#define DMAMUX_SRC_ADC0     40
+#define DMAMUX_SRC_ADC1     41
 
 // Pixel counter for camera logic
 // Starts at -2 so that the SI pulse occurs ADC reads start
 int pixcnt = -2;
 // clkval toggles with each FTM interrupt
 int clkval = 0;
-// line stores the current array of camera data
-uint16_t line[128];
+// Frame ring
+// frames[cam_write] is being filled by the capture ISRs,
+// frames[cam_read] belongs to the control loop and
+// cam_ready is the newest complete frame not yet handed
+// out (-1 if there is none)
+static uint16_t frames[CAM_FRAME_BUFFERS][CAMERA_COUNT][CAM_PIXELS];
+static uint32_t frame_seq[CAM_FRAME_BUFFERS];
+static uint32_t frame_stamp[CAM_FRAME_BUFFERS];
+static volatile int cam_write = 0;
+static volatile int cam_read = CAM_FRAME_BUFFERS - 1;
+static volatile int cam_ready = -1;
+static uint32_t cam_seq = 0;
+#if CAMERA_STREAM_FILTER
+// Derivative of camera 0, filled while the line is captured
+static int16_t frame_deriv[CAM_FRAME_BUFFERS][CAM_PIXELS];
+static FilterStream stream;
+#endif
+// line points at the buffers currently being captured
+static uint16_t* volatile line[CAMERA_COUNT] = {
+    frames[0][0],
+#if CAMERA_COUNT > 1
+    frames[0][1],
+#endif
+};
 
 // These variables are for streaming the camera
 //   data over UART
@@ -51,20 +150,119 @@ int debugcamdata = 0;
 int capcnt = 0;
 char str[100];
 
-// ADC0VAL holds the current ADC value
+// ADC0VAL/ADC1VAL hold the current ADC values
 uint16_t ADC0VAL;
+uint16_t ADC1VAL;
 
-/* Camera_Main
+// Words the DMA copies into GPIOB_PSOR/PCOR. Writing SI to
+// PCOR on every falling edge is harmless once it is low.
+static const uint32_t cam_clk_high = CAM_CLK_MASK;
+static const uint32_t cam_clk_low = CAM_CLK_MASK | CAM_SI_MASK;
+
+/* Camera_GetFrame
 * Description:
-* 	Retrives a scan from the camera
+* 	Takes the newest complete frame from the ring. If no
+*   new frame was published since the last call, the
+*   previous frame is returned again. The frame stays
+*   valid until the next call.
+*
+* Parameters:
+*   frame - filled with the lines, sequence number and
+*           capture timestamp (cycle_count() ticks)
+*
+* Returns:
+*   int - 1 if the frame is new, 0 if it was already seen
+*/
+int Camera_GetFrame(CameraFrame* frame) {
+
+    int fresh = 0;
+
+    // Swap the ready buffer in without the ISR running
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (cam_ready >= 0) {
+        cam_read = cam_ready;
+        cam_ready = -1;
+        fresh = 1;
+    }
+    __set_PRIMASK(primask);
+
+    for (int c = 0; c < CAMERA_COUNT; c++) {
+        frame->lines[c] = frames[cam_read][c];
+    }
+    frame->line = frame->lines[0];
+#if CAMERA_STREAM_FILTER
+    frame->deriv = frame_deriv[cam_read];
+#else
+    frame->deriv = 0;
+#endif
+    frame->seq = frame_seq[cam_read];
+    frame->timestamp = frame_stamp[cam_read];
+
+    return fresh;
+
+} // Camera_GetFrame
+
+/* camera_publish_frame
+* Description:
+* 	Called from the capture ISRs when a line is complete.
+*   Publishes the buffer that was just filled and moves
+*   capture to a buffer the reader does not hold.
 *
 * Parameters:
 *   void
 *
 * Returns:
-*   uint16_t* - 128 int array of camera values
+*   void
 */
-uint16_t* Camera_Main(void) {
+static void camera_publish_frame(void) {
+
+    int i;
+
+#if CAMERA_STREAM_FILTER
+    filter_stream_finish(&stream);
+#endif
+
+    cam_seq += 1;
+    frame_seq[cam_write] = cam_seq;
+    frame_stamp[cam_write] = cycle_count();
+    cam_ready = cam_write;
+
+    for (i = 0; i < CAM_FRAME_BUFFERS; i++) {
+        if ((i != cam_ready) && (i != cam_read)) {
+            cam_write = i;
+            break;
+        }
+    }
+    for (i = 0; i < CAMERA_COUNT; i++) {
+        line[i] = frames[cam_write][i];
+    }
+#if CAMERA_STREAM_FILTER
+    filter_stream_start(&stream, frame_deriv[cam_write]);
+#endif
+
+#if CAMERA_USE_DMA
+    // Point the ADC channels at the new buffers
+    DMA_DADDR_REG(DMA0, CAM_DMA_ADC0) = (uint32_t) line[0];
+#if CAMERA_COUNT > 1
+    DMA_DADDR_REG(DMA0, CAM_DMA_ADC1) = (uint32_t) line[1];
+#endif
+#endif
+
+} // camera_publish_frame
+
+/* camera_debug_stream
+* Description:
+* 	Sends a line over UART every ~2 seconds when
+*   debugcamdata is set
+*
+* Parameters:
+*   cam_line - line to send
+*
+* Returns:
+*   void
+*/
+static void camera_debug_stream(uint16_t* cam_line) {
 
     int i;
 
@@ -76,7 +274,7 @@ uint16_t* Camera_Main(void) {
             sprintf(str,"%i\n\r",-1); // start value
             put(str);
             for (i = 0; i < 127; i++) {
-                sprintf(str,"%i ", line[i]);
+                sprintf(str,"%i ", cam_line[i]);
                 put(str);
             }
             sprintf(str,"\n%i\n\r",-2); // end value
@@ -86,7 +284,58 @@ uint16_t* Camera_Main(void) {
         }
     }
 
-    return line;
+} // camera_debug_stream
+
+/* Camera_WaitFrame
+* Description:
+* 	Sleeps (WFI) until a frame newer than the last one
+*   handed out is published, then takes it. Each captured
+*   line is returned exactly once, so the pipeline runs
+*   once per frame instead of re-processing stale lines.
+*
+* Parameters:
+*   frame - filled with the new frame
+*
+* Returns:
+*   void
+*/
+void Camera_WaitFrame(CameraFrame* frame) {
+
+    // Check and sleep with interrupts masked. WFI still
+    //  wakes on a pending interrupt, and the ISR runs once
+    //  they are unmasked, so a frame published between the
+    //  check and the WFI is not missed.
+    __disable_irq();
+    while (cam_ready < 0) {
+        __WFI();
+        __enable_irq();
+        __disable_irq();
+    }
+    __enable_irq();
+
+    Camera_GetFrame(frame);
+    camera_debug_stream(frame->line);
+
+} // Camera_WaitFrame
+
+/* Camera_Main
+* Description:
+* 	Retrives a scan from the camera
+*
+* Parameters:
+*   void
+*
+* Returns:
+*   uint16_t* - 128 int array of camera values
+*/
+uint16_t* Camera_Main(void) {
+
+    CameraFrame frame;
+
+    Camera_GetFrame(&frame);
+    camera_debug_stream(frame.line);
+
+    return frame.line;
 
 } // Camera_Main
 
@@ -107,6 +356,45 @@ void ADC0_IRQHandler(void) {
 
 } // ADC0_IRQHandler
 
+/* ADC1_IRQHandler
+* Description:
+* 	ADC1 Conversion Complete ISR (camera 1)
+*
+* Parameters:
+* 	void
+*
+* Returns:
+*	void
+*/
+void ADC1_IRQHandler(void) {
+
+	// Reading ADC1_RA clears the conversion complete flag
+	ADC1VAL = ADC1_RA;
+
+} // ADC1_IRQHandler
+
+/* camera_store_pixel
+* Description:
+* 	Stores the latest ADC values of every camera
+*
+* Parameters:
+* 	pixel - index into the line
+*
+* Returns:
+*	void
+*/
+static void camera_store_pixel(int pixel) {
+
+    line[0][pixel] = ADC0VAL;
+#if CAMERA_STREAM_FILTER
+    filter_stream_push(&stream, Calibration_Pixel(ADC0VAL, pixel, 0));
+#endif
+#if CAMERA_COUNT > 1
+    line[1][pixel] = ADC1VAL;
+#endif
+
+} // camera_store_pixel
+
 /* FTM2_IRQHandler
 * Description:
 * 	FTM2 handles the camera driving logic
@@ -136,7 +424,7 @@ void FTM2_IRQHandler(void) {
         if (!clkval) {  // check for falling edge
             // ADC read (note that integer division is
             //  occurring here for indexing the array)
-            line[pixcnt/2] = ADC0VAL;
+            camera_store_pixel(pixcnt/2);
         }
         pixcnt += 1;
     } else if (pixcnt < 2) {
@@ -145,13 +433,14 @@ void FTM2_IRQHandler(void) {
         } else if (pixcnt == 1) {
             GPIOB_PCOR |= (1 << 23); // SI = 0
             // ADC read
-            line[0] = ADC0VAL;
+            camera_store_pixel(0);
         }
         pixcnt += 1;
     } else {
         GPIOB_PCOR |= (1 << 9); // CLK = 0
         clkval = 0; // make sure clock variable = 0
         pixcnt = -2; // reset counter
+        camera_publish_frame();
         // Disable FTM2 interrupts (until PIT0 overflows
         //   again and triggers another line capture)
         FTM2_SC &= ~FTM_SC_TOIE_MASK;
@@ -162,6 +451,34 @@ void FTM2_IRQHandler(void) {
 
 } // FTM2_IRQHandler
 
+/* DMA0_IRQHandler
+* Description:
+* 	DMA channel 0 major loop complete ISR
+*   Called once per line in DMA capture mode, after the
+*   129th CLK falling edge. All 128 samples are in line
+*   by then, so FTM2 is stopped until PIT0 starts the
+*   next readout.
+*
+* Parameters:
+* 	void
+*
+* Returns:
+*	void
+*/
+void DMA0_IRQHandler(void) {
+
+    // Clear interrupt
+    DMA_CINT = DMA_CINT_CINT(CAM_DMA_CLK_LOW);
+
+    // Stop FTM2 (no more CLK edges or ADC triggers)
+    FTM2_SC &= ~FTM_SC_CLKS_MASK;
+
+    camera_publish_frame();
+
+    return;
+
+} // DMA0_IRQHandler
+
 /* PIT0_IRQHandler
 * Description:
 * 	PIT0 determines the integration period
@@ -188,16 +505,87 @@ void PIT0_IRQHandler(void) {
     // Clear interrupt
     PIT_TFLG0 |= PIT_TFLG_TIF_MASK;
 
+#if CAMERA_USE_DMA
+    // Reading the result clears a conversion left over from
+    //  the 129th clock, so it is not DMA'd into line[0]
+    (void) ADC0_RA;
+#if CAMERA_COUNT > 1
+    (void) ADC1_RA;
+#endif
+
+    // SI = 1, latched by the first CLK rising edge
+    GPIOB_PSOR = CAM_SI_MASK;
+
+    // Arm the DMA channels (DREQ disarms them at the end)
+    DMA_SERQ = DMA_SERQ_SERQ(CAM_DMA_ADC0);
+#if CAMERA_COUNT > 1
+    DMA_SERQ = DMA_SERQ_SERQ(CAM_DMA_ADC1);
+#endif
+    DMA_SERQ = DMA_SERQ_SERQ(CAM_DMA_CLK_HIGH);
+    DMA_SERQ = DMA_SERQ_SERQ(CAM_DMA_CLK_LOW);
+
+    // Restart FTM2 from zero
+    FTM2_CNT = 0;
+    FTM2_SC |= FTM_SC_CLKS(1);
+#else
     // Setting mod resets the FTM counter
     FTM2->MOD = DEFAULT_SYSTEM_CLOCK/100000;    // about 200
 
     // Enable FTM2 interrupts (camera)
     FTM2_SC |= FTM_SC_TOIE_MASK;
+#endif
 
     return;
 
 } // PIT0_IRQHandler
 
+/* Camera_SetIntegration
+* Description:
+* 	Changes the integration period (and so the frame
+*   period). The PIT loads the new value when the current
+*   period expires, so the first line captured fully at
+*   the new exposure is the second one after this call.
+*
+* Parameters:
+*   ticks - PIT0 reload value in system clock ticks,
+*           clamped to INTEGRATION_TIME_MIN..MAX
+*
+* Returns:
+*   uint32_t - reload value actually used
+*/
+uint32_t Camera_SetIntegration(uint32_t ticks) {
+
+    uint32_t min = (uint32_t)(DEFAULT_SYSTEM_CLOCK * INTEGRATION_TIME_MIN);
+    uint32_t max = (uint32_t)(DEFAULT_SYSTEM_CLOCK * INTEGRATION_TIME_MAX);
+
+    if (ticks < min) {
+        ticks = min;
+    } else if (ticks > max) {
+        ticks = max;
+    }
+
+    PIT_LDVAL0 = ticks;
+
+    return ticks;
+
+} // Camera_SetIntegration
+
+/* Camera_GetIntegration
+* Description:
+* 	Returns the current PIT0 reload value
+*
+* Parameters:
+*   void
+*
+* Returns:
+*   uint32_t - integration period in system clock ticks
+*/
+uint32_t Camera_GetIntegration(void) {
+
+    return PIT_LDVAL0;
+
+} // Camera_GetIntegration
+
 /* init_FTM2
 * Description:
 * 	Initialization of FTM2 for camera
@@ -210,6 +598,11 @@ void PIT0_IRQHandler(void) {
 */
 void init_FTM2(void) {
 
+#if CAMERA_STREAM_FILTER
+    // Filter the first line into the first buffer
+    filter_stream_start(&stream, frame_deriv[0]);
+#endif
+
     // Enable clock
     SIM_SCGC6 |= SIM_SCGC6_FTM2_MASK;
 
@@ -227,6 +620,29 @@ void init_FTM2(void) {
 
     // Set the period (~10us)
 	int period = DEFAULT_SYSTEM_CLOCK/100000;
+
+#if CAMERA_USE_DMA
+    // One full camera clock per FTM2 period (~20us)
+    FTM2->MOD = 2 * period;
+
+    // CH0 match raises CLK, CH1 match half a clock later
+    //  lowers it and samples the pixel
+    FTM2_C0V = 1;
+    FTM2_C1V = period + 1;
+
+    // Output compare (no FTM2 pins are routed on the board)
+    //  with the channel flag requesting DMA instead of an IRQ
+    FTM2_C0SC = FTM_CnSC_MSA_MASK | FTM_CnSC_ELSA_MASK | \
+                FTM_CnSC_CHIE_MASK | FTM_CnSC_DMA_MASK;
+    FTM2_C1SC = FTM_CnSC_MSA_MASK | FTM_CnSC_ELSA_MASK | \
+                FTM_CnSC_CHIE_MASK | FTM_CnSC_DMA_MASK;
+
+    // Trigger ADC0 on the CH1 match (CLK falling edge)
+    FTM2_EXTTRIG = FTM_EXTTRIG_CH1TRIG_MASK;
+
+    // No overflow interrupts, counter stopped until PIT0
+    FTM2_SC = FTM_SC_PS(0);
+#else
 	FTM2->MOD = period;   // about 200
 
     // 50% duty
@@ -257,6 +673,7 @@ void init_FTM2(void) {
 
     // Set up interrupt
     NVIC_EnableIRQ(FTM2_IRQn);
+#endif
 
     return;
 
@@ -285,7 +702,7 @@ void init_PIT(void) {
 
     // PIT clock frequency is the system clock
     // Load the value that the timer will count down from
-    PIT_LDVAL0 = (uint32_t)(DEFAULT_SYSTEM_CLOCK * INTEGRATION_TIME);
+    Camera_SetIntegration((uint32_t)(DEFAULT_SYSTEM_CLOCK * INTEGRATION_TIME));
 
     // Enable timer interrupts
     PIT_TCTRL0 |= PIT_TCTRL_TIE_MASK;
@@ -382,7 +799,12 @@ void init_ADC0(void) {
 
 	// Set to single ended mode
 	ADC0_SC1A = 0;
+#if CAMERA_USE_DMA
+    // Conversion complete requests DMA instead of an IRQ
+    ADC0_SC2 |= ADC_SC2_DMAEN_MASK;
+#else
 	ADC0_SC1A |= ADC_SC1_AIEN_MASK;
+#endif
     ADC0_SC1A &= ~ADC_SC1_DIFF_MASK;
 	ADC0_SC1A &= ~ADC_SC1_ADCH(0x1F);
 
@@ -392,7 +814,161 @@ void init_ADC0(void) {
     SIM_SOPT7 |= SIM_SOPT7_ADC0ALTTRGEN_MASK; // Alternative trigger en.
     SIM_SOPT7 &= ~SIM_SOPT7_ADC0PRETRGSEL_MASK; // Pretrigger A
 
+#if !CAMERA_USE_DMA
     // Enable NVIC interrupt
 	NVIC_EnableIRQ(ADC0_IRQn);
+#endif
 
 } // init_ADC0
+
+/* init_ADC1
+* Description:
+* 	Set up ADC1 for digitizing camera 1 data
+*   Does nothing when CAMERA_COUNT is 1.
+*
+* Parameters:
+* 	void
+*
+* Returns:
+* 	void
+*/
+void init_ADC1(void) {
+
+#if CAMERA_COUNT > 1
+	unsigned int calib;
+	// Turn on ADC1
+	SIM_SCGC3 |= SIM_SCGC3_ADC1_MASK; // Enables Clock on ADC1
+
+    // Single ended 16 bit conversion, no clock divider
+    ADC1_CFG1 &= ~ADC_CFG1_ADIV_MASK; // No division
+    ADC1_CFG1 |= ADC_CFG1_MODE(0x03); // single ended 16 bit
+
+	// Do ADC Calibration for Singled Ended ADC. Do not touch.
+	ADC1_SC3 = ADC_SC3_CAL_MASK;
+	while ( (ADC1_SC3 & ADC_SC3_CAL_MASK) != 0 );
+	calib = ADC1_CLP0; calib += ADC1_CLP1; calib += ADC1_CLP2;
+	calib += ADC1_CLP3; calib += ADC1_CLP4; calib += ADC1_CLPS;
+	calib = calib >> 1; calib |= 0x8000;
+	ADC1_PG = calib;
+
+	// Select hardware trigger.
+	ADC1_SC2 |= ADC_SC2_ADTRG_MASK;
+
+	// Set to single ended mode
+	ADC1_SC1A = 0;
+#if CAMERA_USE_DMA
+    // Conversion complete requests DMA instead of an IRQ
+    ADC1_SC2 |= ADC_SC2_DMAEN_MASK;
+#else
+	ADC1_SC1A |= ADC_SC1_AIEN_MASK;
+#endif
+    ADC1_SC1A &= ~ADC_SC1_DIFF_MASK;
+	ADC1_SC1A &= ~ADC_SC1_ADCH(0x1F);
+
+    // Set up FTM2 trigger on ADC1
+    SIM_SOPT7 &= ~(0xF << SIM_SOPT7_ADC1TRGSEL_SHIFT);
+    SIM_SOPT7 |= SIM_SOPT7_ADC1TRGSEL(0x0A); // FTM2 select
+    SIM_SOPT7 |= SIM_SOPT7_ADC1ALTTRGEN_MASK; // Alternative trigger en.
+    SIM_SOPT7 &= ~SIM_SOPT7_ADC1PRETRGSEL_MASK; // Pretrigger A
+
+#if !CAMERA_USE_DMA
+    // Enable NVIC interrupt
+	NVIC_EnableIRQ(ADC1_IRQn);
+#endif
+#endif
+
+} // init_ADC1
+
+/* dma_config_channel
+* Description:
+* 	Set up one eDMA channel for a hardware requested
+*   transfer of count elements. The source and destination
+*   addresses are restored at the end of the major loop, so
+*   the channel only needs to be re-armed with SERQ.
+*
+* Parameters:
+*   ch      - eDMA channel
+*   source  - DMAMUX request source
+*   src     - source address
+*   soff    - source offset per element (bytes)
+*   dst     - destination address
+*   doff    - destination offset per element (bytes)
+*   size    - element size as log2(bytes)
+*   count   - number of elements (major loop count)
+*   csr     - TCD control bits (DREQ, INTMAJOR, ...)
+*
+* Returns:
+* 	void
+*/
+static void dma_config_channel(int ch, uint8_t source, \
+                               volatile const void* src, int16_t soff, \
+                               volatile void* dst, int16_t doff, \
+                               uint8_t size, uint16_t count, uint16_t csr) {
+
+    // Route the request to the channel (disable while changing)
+    DMAMUX_CHCFG_REG(DMAMUX, ch) = 0;
+
+    DMA_SADDR_REG(DMA0, ch) = (uint32_t) src;
+    DMA_SOFF_REG(DMA0, ch) = (uint16_t) soff;
+    DMA_ATTR_REG(DMA0, ch) = DMA_ATTR_SSIZE(size) | DMA_ATTR_DSIZE(size);
+    DMA_NBYTES_MLNO_REG(DMA0, ch) = 1UL << size;
+    DMA_SLAST_REG(DMA0, ch) = (uint32_t) (-(int32_t) soff * count);
+
+    DMA_DADDR_REG(DMA0, ch) = (uint32_t) dst;
+    DMA_DOFF_REG(DMA0, ch) = (uint16_t) doff;
+    DMA_DLAST_SGA_REG(DMA0, ch) = (uint32_t) (-(int32_t) doff * count);
+
+    DMA_CITER_ELINKNO_REG(DMA0, ch) = DMA_CITER_ELINKNO_CITER(count);
+    DMA_BITER_ELINKNO_REG(DMA0, ch) = DMA_BITER_ELINKNO_BITER(count);
+    DMA_CSR_REG(DMA0, ch) = csr;
+
+    DMAMUX_CHCFG_REG(DMAMUX, ch) = DMAMUX_CHCFG_ENBL_MASK | \
+                                   DMAMUX_CHCFG_SOURCE(source);
+
+} // dma_config_channel
+
+/* init_DMA
+* Description:
+* 	Set up the eDMA channels for DMA camera capture.
+*   Does nothing when CAMERA_USE_DMA is 0.
+*
+* Parameters:
+* 	void
+*
+* Returns:
+* 	void
+*/
+void init_DMA(void) {
+
+#if CAMERA_USE_DMA
+    // Enable clocks
+    SIM_SCGC6 |= SIM_SCGC6_DMAMUX_MASK;
+    SIM_SCGC7 |= SIM_SCGC7_DMA_MASK;
+
+    // CLK high on every FTM2 CH0 match
+    dma_config_channel(CAM_DMA_CLK_HIGH, DMAMUX_SRC_FTM2_CH0, \
+                       &cam_clk_high, 0, &GPIOB_PSOR, 0, \
+                       2, CAM_CLOCKS, DMA_CSR_DREQ_MASK);
+
+    // CLK and SI low on every FTM2 CH1 match, interrupt
+    //  once the last clock of the line has been sent
+    dma_config_channel(CAM_DMA_CLK_LOW, DMAMUX_SRC_FTM2_CH1, \
+                       &cam_clk_low, 0, &GPIOB_PCOR, 0, \
+                       2, CAM_CLOCKS, \
+                       DMA_CSR_DREQ_MASK | DMA_CSR_INTMAJOR_MASK);
+
+    // ADC results into the line buffers
+    dma_config_channel(CAM_DMA_ADC0, DMAMUX_SRC_ADC0, \
+                       &ADC0_RA, 0, line[0], sizeof(uint16_t), \
+                       1, CAM_PIXELS, DMA_CSR_DREQ_MASK);
+#if CAMERA_COUNT > 1
+    dma_config_channel(CAM_DMA_ADC1, DMAMUX_SRC_ADC1, \
+                       &ADC1_RA, 0, line[1], sizeof(uint16_t), \
+                       1, CAM_PIXELS, DMA_CSR_DREQ_MASK);
+#endif
+
+    // Enable NVIC interrupt
+    NVIC_EnableIRQ(DMA0_IRQn);
+#endif
+
+} // init_DMA
@@ -1,13 +1,36 @@
 #ifndef CAMERA_H_
 #define CAMERA_H_
 
+// Number of linescan cameras (1 or 2)
+// Camera 0 looks near (ADC0), camera 1 looks far (ADC1)
+// Set to 2 only with the far camera fitted: calibration
+// rejects both cameras if one shows no dark/flat difference
+#define CAMERA_COUNT 1
+
+// One complete camera frame handed out by Camera_GetFrame
+typedef struct {
+    uint16_t* line;         // 128 camera 0 values (same as lines[0])
+    uint16_t* lines[CAMERA_COUNT]; // 128 values per camera, same exposure
+    int16_t* deriv;         // filtered camera 0 derivative if the capture
+                            // ISR computed it (streaming filter), else 0
+    uint32_t seq;           // increments by 1 per captured line
+    uint32_t timestamp;     // cycle_count() when the line completed
+} CameraFrame;
+
+int Camera_GetFrame(CameraFrame* frame);
+void Camera_WaitFrame(CameraFrame* frame);
 uint16_t* Camera_Main(void);
+uint32_t Camera_SetIntegration(uint32_t ticks);
+uint32_t Camera_GetIntegration(void);
 void init_FTM2(void);
 void init_GPIO(void);
 void init_PIT(void);
 void init_ADC0(void);
+void init_ADC1(void);
+void init_DMA(void);
 void FTM2_IRQHandler(void);
-void PIT1_IRQHandler(void);
 void ADC0_IRQHandler(void);
+void ADC1_IRQHandler(void);
+void DMA0_IRQHandler(void);
 
 #endif /* CAMERA_H_ */
@@ -35,6 +35,38 @@ void delay(int del){
 }
 
 
+/* init_cycle_counter
+* Description:
+*   Enables the DWT cycle counter used for timestamps
+*   and cycle measurements
+*
+* Parameters:
+*   void
+*
+* Returns:
+*   void
+*/
+void init_cycle_counter(void) {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+/* cycle_count
+* Description:
+*   Reads the DWT cycle counter (system clock ticks,
+*   wraps every ~200 s, so only use differences)
+*
+* Parameters:
+*   void
+*
+* Returns:
+*   uint32_t - current cycle count
+*/
+uint32_t cycle_count(void) {
+    return DWT->CYCCNT;
+}
+
 /* getChar
 * Description:
 *   get a character from the terminal
@@ -54,6 +86,22 @@ uint8_t getChar(void)
     return UART0_D;
 }
 
+/* charReady
+* Description:
+*   check if a character from the terminal is waiting,
+*   so getChar can be called without blocking
+* 
+* Parameters:
+*   void
+* 
+* Returns:
+*   int - 1 if a character is waiting, 0 otherwise
+*/
+int charReady(void)
+{
+    return (UART0_S1 & (1 << 5)) != 0;
+}
+
 /* putChar
 * Description:
 *   put a single character to the terminal
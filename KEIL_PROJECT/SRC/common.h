@@ -1,8 +1,11 @@
 #ifndef COMMON_H_
 #define COMMON_H_
 void delay(int del);
+void init_cycle_counter(void);
+uint32_t cycle_count(void);
 void  put(char *ptr_str );
 uint8_t  getChar(void);
+int  charReady(void);
 void  putChar(char ch);
 void  putnumU(int i);
 void print_array_u(uint16_t* array, int length);
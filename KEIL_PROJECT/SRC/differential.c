@@ -0,0 +1,129 @@
+/*
+ * Electronic differential for the rear motors
+ *
+ * With the front wheels at angle d, the rear axle turns on
+ * a radius R = wheelbase / tan(d), so the inner and outer
+ * rear wheels have to run at
+ *
+ *   (R -+ track / 2) / R = 1 -+ k,  k = track tan(d) / (2 wheelbase)
+ *
+ * times the speed of the axle center. The outer wheel is
+ * given the commanded duty and the inner one is slowed by
+ * (1 - k) / (1 + k), so neither wheel scrubs.
+ *
+ * The wheel angle is taken as linear in the servo count on
+ * each side of center, up to the measured full lock angles.
+ * The inner wheel factor is precomputed for every servo
+ * count (FTM3_C4V value) at init, so a frame only does a
+ * table lookup and a multiply per wheel.
+ *
+ * File:    differential.c
+ * Authors: Seth Deane & Brian Powers
+ * Created: April 21 2019
+ */
+
+#include "MK64F12.h"
+#include "differential.h"
+#include <math.h>
+
+// Servo PWM (as in pwm.c): counts per percent of duty
+#define CLOCK                   20485760u
+#define SERVO_FREQUENCY         50
+#define COUNTS_PER_PERCENT      ((float) (CLOCK/128/SERVO_FREQUENCY) / 100.0f)
+
+// Chassis geometry (mm) and front wheel angle at full lock
+#define WHEELBASE               200.0f
+#define REAR_TRACK              155.0f
+#define LOCK_LEFT_DEG           30.0f
+#define LOCK_RIGHT_DEG          30.0f
+
+#define PI_F                    3.14159265f
+
+// Inner wheel factor per servo count (Q8, 256 = 1.0), and
+//  which side is inside (1 = right turn)
+#define DIFF_MAX_COUNTS         256
+#define DIFF_ONE                256
+static uint16_t inner_factor[DIFF_MAX_COUNTS];
+static uint8_t turn_right[DIFF_MAX_COUNTS];
+static int count_min = 0;
+static int count_max = -1;
+
+/* Function: servo_count
+ * ---------------------
+ *  FTM3_C4V value SetServoDutyCycle writes for a duty.
+ */
+static int servo_count(float duty) {
+    return (int) (duty * COUNTS_PER_PERCENT);
+}
+
+/* Function: Differential_Init
+ * ---------------------------
+ *  Builds the table for the servo range.
+ *
+ *  servo_min, servo_mid, servo_max: servo duty (percent) at
+ *      full left, straight ahead and full right
+ *
+ *  Returns: void
+ */
+void Differential_Init(float servo_min, float servo_mid, float servo_max) {
+    int mid = servo_count(servo_mid);
+
+    count_min = servo_count(servo_min);
+    count_max = servo_count(servo_max);
+    if (count_max - count_min >= DIFF_MAX_COUNTS) {
+        count_max = count_min + DIFF_MAX_COUNTS - 1;
+    }
+
+    for (int c = count_min; c <= count_max; c++) {
+        float angle;
+        int i = c - count_min;
+
+        if (c >= mid) {
+            angle = LOCK_RIGHT_DEG * (float) (c - mid) / (float) (count_max - mid);
+        } else {
+            angle = LOCK_LEFT_DEG * (float) (mid - c) / (float) (mid - count_min);
+        }
+
+        float k = REAR_TRACK * tanf(angle * PI_F / 180.0f) / (2.0f * WHEELBASE);
+        inner_factor[i] = (uint16_t) ((float) DIFF_ONE * (1.0f - k) / (1.0f + k) + 0.5f);
+        turn_right[i] = (c > mid);
+    }
+}
+
+/* Function: Differential_Split
+ * ----------------------------
+ *  Rear wheel duties for a steering position.
+ *
+ *  servo_duty: servo duty (percent), clamped to the range
+ *      given to Differential_Init
+ *  duty: motor duty for the outer wheel (percent)
+ *  duty_left, duty_right: output wheel duties (percent)
+ *
+ *  Returns: void
+ */
+void Differential_Split(float servo_duty, int duty, int* duty_left, int* duty_right) {
+    int c = servo_count(servo_duty);
+
+    if (count_max < count_min) {
+        // not initialized, no differential
+        *duty_left = duty;
+        *duty_right = duty;
+        return;
+    }
+    if (c < count_min) {
+        c = count_min;
+    } else if (c > count_max) {
+        c = count_max;
+    }
+
+    int i = c - count_min;
+    int inner = (duty * inner_factor[i]) / DIFF_ONE;
+
+    if (turn_right[i]) {
+        *duty_left = duty;
+        *duty_right = inner;
+    } else {
+        *duty_left = inner;
+        *duty_right = duty;
+    }
+}
@@ -0,0 +1,5 @@
+#ifndef  DIFFERENTIAL_H_
+#define  DIFFERENTIAL_H_
+void Differential_Init(float servo_min, float servo_mid, float servo_max);
+void Differential_Split(float servo_duty, int duty, int* duty_left, int* duty_right);
+#endif  /*  ifndef  DIFFERENTIAL_H_  */
@@ -0,0 +1,231 @@
+/*
+ * Multi-candidate track edge detector
+ *
+ * Every derivative peak above mean + stdev is a candidate
+ * left edge (dark to white) and every trough below
+ * mean - stdev a candidate right edge. Each left/right
+ * pair, and each single edge, is scored against
+ *   - a track width prior, learned from confident pairs
+ *   - the previous track center
+ *   - the strength of its peaks
+ * and the lowest cost wins. Shadows and track markings add
+ * candidates, but rarely at the right width and position.
+ *
+ * The winning cost is turned into a confidence for the
+ * tracker and the safety logic downstream.
+ *
+ * File:    edges.c
+ * Authors: Seth Deane & Brian Powers
+ * Created: April 15 2019
+ */
+
+#include "MK64F12.h"
+#include "filters.h"
+#include "edges.h"
+
+// Number of pixels in a line
+#define PIXELS              128
+
+// Track width prior (pixels): starting value, limits and
+//  the spread accepted around it
+#define WIDTH_START         80.0f
+#define WIDTH_MIN           20.0f
+#define WIDTH_MAX           126.0f
+#define WIDTH_SIGMA         8.0f
+// Learning rate of the width prior, and the confidence a
+//  pair needs to update it
+#define WIDTH_RATE          (1.0f / 16.0f)
+#define WIDTH_LEARN_CONF    (EDGE_CONF_ONE * 3 / 4)
+
+// Spread of the center around the previous center (pixels)
+#define CENTER_SIGMA        12.0f
+// Weight of the peak strength term
+#define STRENGTH_COST       1.0f
+// Extra cost of explaining the line with one edge only (so
+//  a fitting pair wins), and the confidence of a single edge
+//  right where the prior puts it. One border is all there is
+//  in tight curves, so it has to rate above the safety
+//  recover level (SAFETY_CONF_ONE scale, safety.c).
+#define SINGLE_COST         4.0f
+#define SINGLE_CONF         (EDGE_CONF_ONE * 3 / 4)
+
+// One candidate edge
+typedef struct {
+    float pos;              // pixels
+    float strength;         // |peak - mean| / stdev (>= 1)
+} Candidate;
+
+static Candidate rising[EDGE_MAX_CANDIDATES];
+static Candidate falling[EDGE_MAX_CANDIDATES];
+
+// Learned track width (pixels)
+static float width = WIDTH_START;
+
+/* Function: find_candidates
+ * -------------------------
+ *  Lists the peaks (sign 1) or troughs (sign -1) of the
+ *  derivative beyond one stdev from the mean.
+ *
+ *  Returns: number of candidates
+ */
+static int find_candidates(int16_t* deriv_sig, int mean, int stdev, int sign, Candidate* list) {
+    int count = 0;
+
+    for (int i = 1; (i < PIXELS - 1) && (count < EDGE_MAX_CANDIDATES); i++) {
+        int32_t v = sign * (deriv_sig[i] - mean);
+        if ((v > stdev) && (v > sign * (deriv_sig[i-1] - mean)) && \
+            (v >= sign * (deriv_sig[i+1] - mean))) {
+            list[count].pos = (float) peak_subpixel(deriv_sig, PIXELS, i) / \
+                              (float) (1 << SUBPIXEL_SHIFT);
+            list[count].strength = (float) v / (float) stdev;
+            count++;
+        }
+    }
+    return count;
+}
+
+/* Function: shape_cost
+ * --------------------
+ *  Width and center part of the cost of an edge pair.
+ */
+static float shape_cost(float left, float right, float prev_middle) {
+    float dw = ((right - left) - width) / WIDTH_SIGMA;
+    float dc = (0.5f * (left + right) - prev_middle) / CENTER_SIGMA;
+    return dw * dw + dc * dc;
+}
+
+/* Function: to_sub
+ * ----------------
+ *  Converts a position in pixels to fixed point.
+ */
+static int32_t to_sub(float pos) {
+    return (int32_t) (pos * (float) (1 << SUBPIXEL_SHIFT) + 0.5f);
+}
+
+/* Function: Edges_Reset
+ * ---------------------
+ *  Forgets the learned track width.
+ *
+ *  Returns: void
+ */
+void Edges_Reset(void) {
+    width = WIDTH_START;
+}
+
+/* Function: Edges_Find
+ * --------------------
+ *  Picks the most likely track edges of a derivative line.
+ *
+ *  deriv_sig: filtered derivative of the camera line
+ *  prev_middle_sub: previous track center (SUBPIXEL_SHIFT
+ *      fixed point)
+ *  pair: output edges and confidence
+ *
+ *  Returns: 1 if at least one edge was found, 0 otherwise
+ */
+int Edges_Find(int16_t* deriv_sig, int32_t prev_middle_sub, EdgePair* pair) {
+    int mean, stdev;
+    float prev = (float) prev_middle_sub / (float) (1 << SUBPIXEL_SHIFT);
+    float best_cost = 1e30f;
+    float best_shape = 0.0f;
+    int best_left = -1;
+    int best_right = -1;
+
+    pair->left_found = 0;
+    pair->right_found = 0;
+    pair->confidence = 0;
+    pair->left_sub = to_sub(prev - 0.5f * width);
+    pair->right_sub = to_sub(prev + 0.5f * width);
+
+    signal_stats(deriv_sig, PIXELS, &mean, &stdev);
+    if (stdev == 0) {
+        return 0;
+    }
+
+    int n_left = find_candidates(deriv_sig, mean, stdev, 1, rising);
+    int n_right = find_candidates(deriv_sig, mean, stdev, -1, falling);
+
+    // Pairs
+    for (int l = 0; l < n_left; l++) {
+        for (int r = 0; r < n_right; r++) {
+            float w = falling[r].pos - rising[l].pos;
+            if ((w < WIDTH_MIN) || (w > WIDTH_MAX)) {
+                continue;
+            }
+            float shape = shape_cost(rising[l].pos, falling[r].pos, prev);
+            float cost = shape + STRENGTH_COST * 2.0f / (rising[l].strength + falling[r].strength);
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_shape = shape;
+                best_left = l;
+                best_right = r;
+            }
+        }
+    }
+
+    // Single edges, the other one a track width away
+    for (int l = 0; l < n_left; l++) {
+        float dc = (rising[l].pos + 0.5f * width - prev) / CENTER_SIGMA;
+        float cost = dc * dc + SINGLE_COST + STRENGTH_COST / rising[l].strength;
+        if (cost < best_cost) {
+            best_cost = cost;
+            best_shape = dc * dc;
+            best_left = l;
+            best_right = -1;
+        }
+    }
+    for (int r = 0; r < n_right; r++) {
+        float dc = (falling[r].pos - 0.5f * width - prev) / CENTER_SIGMA;
+        float cost = dc * dc + SINGLE_COST + STRENGTH_COST / falling[r].strength;
+        if (cost < best_cost) {
+            best_cost = cost;
+            best_shape = dc * dc;
+            best_left = -1;
+            best_right = r;
+        }
+    }
+
+    if ((best_left < 0) && (best_right < 0)) {
+        return 0;
+    }
+
+    if (best_left >= 0) {
+        pair->left_found = 1;
+        pair->left_sub = to_sub(rising[best_left].pos);
+    }
+    if (best_right >= 0) {
+        pair->right_found = 1;
+        pair->right_sub = to_sub(falling[best_right].pos);
+    }
+    if (best_left < 0) {
+        pair->left_sub = to_sub(falling[best_right].pos - width);
+    }
+    if (best_right < 0) {
+        pair->right_sub = to_sub(rising[best_left].pos + width);
+    }
+
+    // 1 for a pair at the prior width and previous center,
+    //  1/2 for one a sigma off in both. A single edge tops
+    //  out at SINGLE_CONF (its cost penalty only ranks it
+    //  below pairs, it doesn't make the edge less certain).
+    int full = (pair->left_found && pair->right_found) ? EDGE_CONF_ONE : SINGLE_CONF;
+    pair->confidence = (int) ((float) full / (1.0f + 0.5f * best_shape));
+
+    // Learn the width from confident pairs, or from lines
+    //  with no other candidates (lets a bad start converge)
+    if (pair->left_found && pair->right_found && \
+        ((pair->confidence >= WIDTH_LEARN_CONF) || ((n_left == 1) && (n_right == 1)))) {
+        width += WIDTH_RATE * ((falling[best_right].pos - rising[best_left].pos) - width);
+    }
+    return 1;
+}
+
+/* Function: Edges_Width
+ * ---------------------
+ *  Learned track width.
+ *
+ *  Returns: width (SUBPIXEL_SHIFT fixed point)
+ */
+int32_t Edges_Width(void) {
+    return to_sub(width);
+}
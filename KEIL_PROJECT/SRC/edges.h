@@ -0,0 +1,23 @@
+#ifndef  EDGES_H_
+#define  EDGES_H_
+
+// Most candidates kept per edge direction
+#define EDGE_MAX_CANDIDATES 16
+
+// Confidence of a perfect pair
+#define EDGE_CONF_ONE       256
+
+// Track edges picked from one derivative line. Positions
+// are fixed point with SUBPIXEL_SHIFT fraction bits. A
+// missing edge is placed a learned track width from the
+// other one (or from the previous center).
+typedef struct {
+    int32_t left_sub, right_sub;
+    int left_found, right_found;
+    int confidence;                 // 0..EDGE_CONF_ONE
+} EdgePair;
+
+void Edges_Reset(void);
+int Edges_Find(int16_t* deriv_sig, int32_t prev_middle_sub, EdgePair* pair);
+int32_t Edges_Width(void);
+#endif  /*  ifndef  EDGES_H_  */
@@ -0,0 +1,137 @@
+/*
+ * Rear wheel encoders
+ *
+ * Left wheel: quadrature encoder on FTM1 in quadrature
+ * decoder mode (phase A PTB0, phase B PTB1, ALT6). FTM1
+ * counts every edge of both phases, up or down with the
+ * direction, in a free running 16 bit counter.
+ *
+ * Right wheel: FTM2 is the other timer with a quadrature
+ * decoder but it clocks the cameras, so the right encoder's
+ * phase A goes to LPTMR0 as a pulse counter (LPTMR0_ALT2,
+ * PTC5, ALT3). It counts rising edges only and can't see
+ * the direction, so its count is scaled by 4 to the
+ * quadrature edge units of the left wheel and taken as
+ * forward (the motors are only driven forward).
+ *
+ * Encoder_Delta() extends the 16 bit counters: it has to be
+ * called before a wheel turns 32767 edges (speed.c calls it
+ * every SPEED_PERIOD).
+ *
+ * File:    encoder.c
+ * Authors: Seth Deane & Brian Powers
+ * Created: April 24 2019
+ */
+
+#include "MK64F12.h"
+#include "encoder.h"
+
+// Quadrature edges per counted LPTMR pulse
+#define PULSE_EDGES     4
+
+// 1, or -1 if the left encoder counts down going forward
+#define LEFT_DIRECTION  1
+
+// Input filter on the quadrature phases (x4 system clocks)
+#define QD_FILTER       4
+
+// Counter values at the last Encoder_Delta()
+static uint16_t last_count[2];
+
+/* read_right
+* Description:
+*   Latches and reads the LPTMR0 pulse count.
+*
+* Parameters:
+*   void
+*
+* Returns:
+*   uint16_t - pulses counted
+*/
+static uint16_t read_right(void) {
+
+    // Writing CNR latches the counter so it can be read
+    LPTMR0_CNR = 0;
+    return (uint16_t) LPTMR0_CNR;
+
+} // read_right
+
+/* Encoder_Init
+* Description:
+*   Sets up FTM1 as the left quadrature decoder and LPTMR0
+*   as the right pulse counter.
+*
+* Parameters:
+*   void
+*
+* Returns:
+*   void
+*/
+void Encoder_Init(void) {
+
+    // Enable clocks on FTM1, LPTMR0 and the pin ports
+    SIM_SCGC6 |= SIM_SCGC6_FTM1_MASK;
+    SIM_SCGC5 |= SIM_SCGC5_LPTMR_MASK | SIM_SCGC5_PORTB_MASK | SIM_SCGC5_PORTC_MASK;
+
+    // FTM1_QD_PHA, FTM1_QD_PHB
+    PORTB_PCR0 = PORT_PCR_MUX(6);
+    PORTB_PCR1 = PORT_PCR_MUX(6);
+
+    // LPTMR0_ALT2 (ALT3 on PTC5)
+    PORTC_PCR5 = PORT_PCR_MUX(3);
+
+    // FTM1: disable write protection, free running 16 bits
+    FTM1_MODE |= FTM_MODE_WPDIS_MASK;
+    FTM1_MODE |= FTM_MODE_FTMEN_MASK;
+    FTM1_CNTIN = 0;
+    FTM1_MOD = 0xFFFF;
+    FTM1_CNT = 0;
+
+    // Phase A/B decoding with the input filters on
+    FTM1_FILTER = FTM_FILTER_CH0FVAL(QD_FILTER) | FTM_FILTER_CH1FVAL(QD_FILTER);
+    FTM1_QDCTRL = FTM_QDCTRL_QUADEN_MASK | FTM_QDCTRL_PHAFLTREN_MASK | \
+                  FTM_QDCTRL_PHBFLTREN_MASK;
+
+    // A clock source has to be selected for the counter to run
+    FTM1_SC = FTM_SC_CLKS(1);
+
+    // LPTMR0: pulse counter on ALT2, rising edges, glitch
+    //  filter bypassed, free running
+    LPTMR0_CSR = 0;
+    LPTMR0_PSR = LPTMR_PSR_PBYP_MASK | LPTMR_PSR_PCS(1);
+    LPTMR0_CMR = 0xFFFF;
+    LPTMR0_CSR = LPTMR_CSR_TMS_MASK | LPTMR_CSR_TPS(2) | LPTMR_CSR_TFC_MASK;
+    LPTMR0_CSR |= LPTMR_CSR_TEN_MASK;
+
+    last_count[ENCODER_LEFT] = (uint16_t) FTM1_CNT;
+    last_count[ENCODER_RIGHT] = read_right();
+
+} // Encoder_Init
+
+/* Encoder_Delta
+* Description:
+*   Wheel movement since the last call.
+*
+* Parameters:
+*   wheel - ENCODER_LEFT or ENCODER_RIGHT
+*
+* Returns:
+*   int32_t - quadrature edges, positive forward
+*/
+int32_t Encoder_Delta(int wheel) {
+
+    uint16_t count;
+
+    if (wheel == ENCODER_LEFT) {
+        count = (uint16_t) FTM1_CNT;
+        int16_t delta = (int16_t) (count - last_count[ENCODER_LEFT]);
+        last_count[ENCODER_LEFT] = count;
+        return (int32_t) delta * LEFT_DIRECTION;
+    }
+
+    count = read_right();
+    uint16_t pulses = (uint16_t) (count - last_count[ENCODER_RIGHT]);
+    last_count[ENCODER_RIGHT] = count;
+    return (int32_t) pulses * PULSE_EDGES;
+
+} // Encoder_Delta
@@ -0,0 +1,11 @@
+#ifndef ENCODER_H_
+#define ENCODER_H_
+
+// Wheel selectors
+#define ENCODER_LEFT    0
+#define ENCODER_RIGHT   1
+
+void Encoder_Init(void);
+int32_t Encoder_Delta(int wheel);
+
+#endif /* ENCODER_H_ */
@@ -0,0 +1,93 @@
+/*
+ * Closed-loop auto-exposure for the linescan camera
+ *
+ * Adjusts the PIT0 integration period once per frame so
+ * the brightest pixel of the line sits near a target
+ * level. A bright venue shortens the integration period,
+ * which also raises the frame rate.
+ *
+ * File:    exposure.c
+ * Authors: Seth Deane & Brian Powers
+ * Created: April 4 2019
+ */
+
+#include "MK64F12.h"
+#include "camera.h"
+#include "exposure.h"
+
+// Number of pixels in a line
+#define PIXELS              128
+
+// Target peak level (16 bit ADC, ~75% of full scale)
+#define PEAK_TARGET         49152u
+// Peak at or above this is treated as saturated
+#define PEAK_SATURATED      64000u
+// Don't change exposure if the peak is within target/16
+#define PEAK_DEADBAND       (PEAK_TARGET / 16)
+// Lines with a mean below this are treated as black (lens
+//  covered, car lifted) and don't open the exposure up
+#define MEAN_MIN            256u
+
+// Frames to skip after a change (the PIT loads the new
+//  value one period late, see Camera_SetIntegration)
+#define SETTLE_FRAMES       2
+
+// First frame sequence number measured at the current
+//  integration period
+static uint32_t settle_seq = 0;
+
+/* Function: Exposure_Update
+ * -------------------------
+ *  Looks at the peak and mean of a frame and scales the
+ *  integration period towards PEAK_TARGET. The scale is
+ *  limited to x0.5..x2 per step, and a saturated line
+ *  halves the period since its true peak is unknown.
+ *
+ *  frame: newest camera frame
+ *
+ *  Returns: void
+ */
+void Exposure_Update(CameraFrame* frame) {
+
+    uint32_t peak = 0;
+    uint32_t total = 0;
+    uint32_t ticks;
+    uint32_t new_ticks;
+
+    // Wait for a frame captured at the current period
+    if ((int32_t)(frame->seq - settle_seq) < 0) {
+        return;
+    }
+
+    for (int i = 0; i < PIXELS; i++) {
+        uint32_t value = frame->line[i];
+        total += value;
+        if (value > peak) {
+            peak = value;
+        }
+    }
+
+    if ((total / PIXELS) < MEAN_MIN) {
+        return;
+    }
+
+    ticks = Camera_GetIntegration();
+
+    if (peak >= PEAK_SATURATED) {
+        new_ticks = ticks / 2;
+    } else if ((peak + PEAK_DEADBAND > PEAK_TARGET) && \
+               (peak < PEAK_TARGET + PEAK_DEADBAND)) {
+        return;
+    } else if (peak < PEAK_TARGET / 2) {
+        new_ticks = ticks * 2;
+    } else {
+        // ticks * target / peak (64 bit so 100 ms doesn't overflow)
+        new_ticks = (uint32_t)(((uint64_t) ticks * PEAK_TARGET) / peak);
+    }
+
+    new_ticks = Camera_SetIntegration(new_ticks);
+
+    if (new_ticks != ticks) {
+        settle_seq = frame->seq + SETTLE_FRAMES;
+    }
+}
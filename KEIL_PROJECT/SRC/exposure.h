@@ -0,0 +1,4 @@
+#ifndef  EXPOSURE_H_
+#define  EXPOSURE_H_
+void Exposure_Update(CameraFrame* frame);
+#endif  /*  ifndef  EXPOSURE_H_  */
@@ -1,5 +1,7 @@
 
 #include "MK64F12.h"
+#include "filters.h"
+#include <string.h>
 
 /* 
  * Function: median_filter
@@ -55,7 +57,9 @@ void median_filter(uint16_t *x, uint16_t *y, int x_size) {
 /* 
  * Function: convolve
  * ------------------
- *  Filters a 1D signal with the given inputs.
+ *  Filters a 1D signal with the given inputs. Accumulates in 32 bit integers
+ *  (the M4F FPU is single precision only, so double was soft-float) and
+ *  truncates like the old double version did.
  *
  *  x: input array
  *  h: filter array
@@ -70,8 +74,8 @@ void median_filter(uint16_t *x, uint16_t *y, int x_size) {
 void convolve(uint16_t *x, int16_t *h, uint16_t *y, int xSize, int hSize, int correction) {
     for (int i=(hSize-1);i <  xSize; i++)
     {
-        double sum = 0.0;
-        for (int j=hSize; j >=0; j--)
+        int32_t sum = 0;
+        for (int j=hSize-1; j >=0; j--)
         {
             sum += h[j] * x[i-j];   //inner dot product
         }
@@ -83,6 +87,7 @@ void convolve(uint16_t *x, int16_t *h, uint16_t *y, int xSize, int hSize, int co
  * Function: der_convolve
  * ----------------------
  *  Filters to the derivative of a given signal. Outputs a signed int array.
+ *  Integer accumulation, see convolve.
  *
  *  x: input array
  *  h: filter array
@@ -98,11 +103,592 @@ void convolve(uint16_t *x, int16_t *h, uint16_t *y, int xSize, int hSize, int co
 void der_convolve(uint16_t *x, int16_t *h, int16_t *y, int xSize, int hSize, int correction) {
     for (int i=(hSize-1);i <  xSize; i++)
     {
-        double sum = 0.0;
-        for (int j=hSize; j >=0; j--)
+        int32_t sum = 0;
+        for (int j=hSize-1; j >=0; j--)
         {
             sum += h[j] * x[i-j];   //inner dot product
         }
         y[i] = sum / correction;
     }
 }
+
+/* 
+ * Function: median3
+ * -----------------
+ *  Median of three values.
+ *
+ *  Returns: the middle value
+ */
+static inline uint16_t median3(uint16_t a, uint16_t b, uint16_t c) {
+    if (a > b) {
+        uint16_t t = a;
+        a = b;
+        b = t;
+    }
+    // a <= b, median is b clamped to [a, c]
+    if (b > c) {
+        b = (a > c) ? a : c;
+    }
+    return b;
+}
+
+/* 
+ * Function: median_at
+ * -------------------
+ *  Three point median of x around index i, with the same edge handling as
+ *  median_filter (min of the first two, max of the last two).
+ *
+ *  Returns: median value at i
+ */
+static inline uint16_t median_at(uint16_t *x, int i, int x_size) {
+    if (i == 0) {
+        return (x[0] < x[1]) ? x[0] : x[1];
+    }
+    else if (i == x_size - 1) {
+        return (x[i] > x[i-1]) ? x[i] : x[i-1];
+    }
+    return median3(x[i-1], x[i], x[i+1]);
+}
+
+/* 
+ * Function: filter_fused
+ * ----------------------
+ *  Single pass version of the filter_main chain: 3 point median, {1,2,4,2,1}/10
+ *  weighted average and {1,0,-1} derivative. Only a 5 sample median window and
+ *  the last two averages are kept, so no intermediate arrays are needed.
+ *
+ *  Matches the three pass chain: the average w is centred (the old shift-by-2
+ *  fix-up), w[0..1] repeat w[2], w[126..127] repeat w[125], and
+ *  y[i] = w[i] - w[i-2]. y[0] and y[1] (never written by the old chain) are 0.
+ *
+ *  x: input array
+ *  y: output array (derivative)
+ *  x_size: size of arrays (at least 5)
+ *
+ *  Returns: void
+ */
+void filter_fused(uint16_t *x, int16_t *y, int x_size) {
+    // median window m[k-2..k+2]
+    uint32_t m0 = median_at(x, 0, x_size);
+    uint32_t m1 = median_at(x, 1, x_size);
+    uint32_t m2 = median_at(x, 2, x_size);
+    uint32_t m3 = median_at(x, 3, x_size);
+    uint32_t m4;
+    // weighted average at k-2 and k-1
+    uint16_t w_old2 = 0;
+    uint16_t w_old1 = 0;
+
+    y[0] = 0;
+    y[1] = 0;
+
+    for (int k = 2; k < x_size - 2; k++) {
+        m4 = median_at(x, k + 2, x_size);
+
+        uint16_t w = (m0 + 2*m1 + 4*m2 + 2*m3 + m4) / 10;
+
+        // w[0] and w[1] repeat w[2]
+        if (k == 2) {
+            w_old2 = w;
+            w_old1 = w;
+        }
+
+        y[k] = w - w_old2;
+
+        w_old2 = w_old1;
+        w_old1 = w;
+        m0 = m1;
+        m1 = m2;
+        m2 = m3;
+        m3 = m4;
+    }
+
+    // w[x_size-2] and w[x_size-1] repeat w[x_size-3]
+    y[x_size - 2] = w_old1 - w_old2;
+    y[x_size - 1] = 0;
+}
+
+#if FILTERS_USE_SIMD
+/* 
+ * Function: load_pair / store_pair
+ * --------------------------------
+ *  Packed access to two neighbouring 16 bit samples (low halfword = lower
+ *  index). memcpy compiles to a single LDR/STR on the M4, which allows
+ *  unaligned word access, so the arrays need no special alignment.
+ */
+static inline uint32_t load_pair(const void *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void store_pair(void *p, uint32_t v) {
+    memcpy(p, &v, sizeof(v));
+}
+
+/* 
+ * Function: umin16 / umax16
+ * -------------------------
+ *  Per halfword unsigned min/max. USUB16 sets the GE flags of each lane where
+ *  a >= b and SEL picks lanes by those flags.
+ */
+static inline uint32_t umin16(uint32_t a, uint32_t b) {
+    __USUB16(a, b);
+    return __SEL(b, a);
+}
+
+static inline uint32_t umax16(uint32_t a, uint32_t b) {
+    __USUB16(a, b);
+    return __SEL(a, b);
+}
+
+/* 
+ * Function: median_pair
+ * ---------------------
+ *  Packed 3 point medians of pixels 2j and 2j+1, with the median_filter edge
+ *  handling for the first and last pair.
+ *
+ *  Returns: (m[2j], m[2j+1]) as one word
+ */
+static inline uint32_t median_pair(uint16_t *x, int j, int x_size) {
+    int i = 2*j;
+    if ((i == 0) || (i + 2 >= x_size)) {
+        return median_at(x, i, x_size) | ((uint32_t) median_at(x, i + 1, x_size) << 16);
+    }
+    uint32_t b = load_pair(&x[i]);                  // x[i],   x[i+1]
+    uint32_t a = (b << 16) | x[i-1];                // x[i-1], x[i]
+    uint32_t c = (b >> 16) | ((uint32_t) x[i+2] << 16); // x[i+1], x[i+2]
+    return umax16(umin16(a, b), umin16(umax16(a, b), c));
+}
+#endif
+
+/* 
+ * Function: filter_fused_simd
+ * ---------------------------
+ *  filter_fused using the Cortex-M4 DSP extension, two pixels per instruction:
+ *  USUB16/SEL for the medians, SMUAD/SMLAD dual multiply-accumulates for the
+ *  {1,2,4,2,1} average and SSUB16 for the derivative. Output is bit-exact with
+ *  filter_fused, which is also used when FILTERS_USE_SIMD is 0.
+ *
+ *  SMLAD multiplies signed halfwords, so the medians are offset by -32768
+ *  (top bit flipped) and 32768 * 10 is added back to each sum.
+ *
+ *  x: input array
+ *  y: output array (derivative)
+ *  x_size: size of arrays (even, at least 6)
+ *
+ *  Returns: void
+ */
+void filter_fused_simd(uint16_t *x, int16_t *y, int x_size) {
+#if FILTERS_USE_SIMD
+    const uint32_t bias = 0x80008000u;
+    const uint32_t c_12 = 0x00020001u;  // (1, 2)
+    const uint32_t c_42 = 0x00020004u;  // (4, 2)
+    const uint32_t c_10 = 0x00000001u;  // (1, 0)
+    const uint32_t c_01 = 0x00010000u;  // (0, 1)
+    const uint32_t c_24 = 0x00040002u;  // (2, 4)
+    const uint32_t c_21 = 0x00010002u;  // (2, 1)
+    const int32_t offset = 32768 * 10;
+
+    // median pairs m[k-2..k-1], m[k..k+1], m[k+2..k+3]
+    uint32_t m_prev = median_pair(x, 0, x_size) ^ bias;
+    uint32_t m_cur = median_pair(x, 1, x_size) ^ bias;
+    uint32_t m_next;
+    // averages w[k-2..k-1]
+    uint32_t w_old = 0;
+
+    store_pair(&y[0], 0);
+
+    for (int k = 2; k < x_size - 2; k += 2) {
+        m_next = median_pair(x, (k >> 1) + 1, x_size) ^ bias;
+
+        int32_t sum0 = __SMLAD(m_next, c_10, __SMLAD(m_cur, c_42, __SMUAD(m_prev, c_12)));
+        int32_t sum1 = __SMLAD(m_prev, c_01, __SMLAD(m_next, c_21, __SMUAD(m_cur, c_24)));
+        uint32_t w0 = (uint32_t)(sum0 + offset) / 10;
+        uint32_t w1 = (uint32_t)(sum1 + offset) / 10;
+        uint32_t w = (w0 & 0xFFFF) | (w1 << 16);
+
+        // w[0] and w[1] repeat w[2]
+        if (k == 2) {
+            w_old = (w0 & 0xFFFF) | (w0 << 16);
+        }
+
+        store_pair(&y[k], __SSUB16(w, w_old));
+
+        w_old = w;
+        m_prev = m_cur;
+        m_cur = m_next;
+    }
+
+    // w[x_size-2] and w[x_size-1] repeat w[x_size-3]
+    y[x_size - 2] = (w_old >> 16) - (w_old & 0xFFFF);
+    y[x_size - 1] = 0;
+#else
+    filter_fused(x, y, x_size);
+#endif
+}
+
+/* 
+ * Function: filter_stream_start
+ * -----------------------------
+ *  Starts an incremental run of the filter_fused chain. Samples are then fed
+ *  one at a time with filter_stream_push as they are captured, and the
+ *  derivative is written to y as soon as its inputs are known (three samples
+ *  behind the newest one). filter_stream_finish completes the line.
+ *
+ *  s: stream state
+ *  y: output array (derivative)
+ *
+ *  Returns: void
+ */
+void filter_stream_start(FilterStream *s, int16_t *y) {
+    s->y = y;
+    s->count = 0;
+    y[0] = 0;
+    y[1] = 0;
+}
+
+/* 
+ * Function: filter_stream_median
+ * ------------------------------
+ *  Adds median m[j] to the window and outputs the derivative sample it
+ *  completes (y[j-2], once five medians are known).
+ */
+static void filter_stream_median(FilterStream *s, uint32_t median, int j) {
+    s->m[0] = s->m[1];
+    s->m[1] = s->m[2];
+    s->m[2] = s->m[3];
+    s->m[3] = s->m[4];
+    s->m[4] = median;
+
+    if (j >= 4) {
+        int k = j - 2;
+        uint16_t w = (s->m[0] + 2*s->m[1] + 4*s->m[2] + 2*s->m[3] + s->m[4]) / 10;
+
+        // w[0] and w[1] repeat w[2]
+        if (k == 2) {
+            s->w_old2 = w;
+            s->w_old1 = w;
+        }
+
+        s->y[k] = w - s->w_old2;
+
+        s->w_old2 = s->w_old1;
+        s->w_old1 = w;
+    }
+}
+
+/* 
+ * Function: filter_stream_push
+ * ----------------------------
+ *  Feeds the next camera sample (samples must arrive in pixel order).
+ *
+ *  s: stream state
+ *  sample: camera value of pixel s->count
+ *
+ *  Returns: void
+ */
+void filter_stream_push(FilterStream *s, uint16_t sample) {
+    int i = s->count;
+
+    s->x[0] = s->x[1];
+    s->x[1] = sample;
+    s->count = i + 1;
+
+    if (i == 1) {
+        // first median, min of the first two
+        filter_stream_median(s, (s->x[0] < s->x[1]) ? s->x[0] : s->x[1], 0);
+    }
+    else if (i > 1) {
+        filter_stream_median(s, median3(s->x_old, s->x[0], s->x[1]), i - 1);
+    }
+    s->x_old = s->x[0];
+}
+
+/* 
+ * Function: filter_stream_finish
+ * ------------------------------
+ *  Completes the line after the last sample was pushed. y then holds the
+ *  same values filter_fused gives for the whole line.
+ *
+ *  s: stream state
+ *
+ *  Returns: void
+ */
+void filter_stream_finish(FilterStream *s) {
+    int n = s->count;
+
+    // last median, max of the last two
+    filter_stream_median(s, (s->x[1] > s->x[0]) ? s->x[1] : s->x[0], n - 1);
+
+    // w[n-2] and w[n-1] repeat w[n-3]
+    s->y[n - 2] = s->w_old1 - s->w_old2;
+    s->y[n - 1] = 0;
+}
+
+// Compare-exchange for the sorting networks (a <= b afterwards). Written as
+// selects so the compiler emits conditional moves rather than branches.
+#define SORT2(a, b) { uint16_t lo_ = ((a) < (b)) ? (a) : (b); \
+                      (b) = ((a) < (b)) ? (b) : (a); \
+                      (a) = lo_; }
+
+/* 
+ * Function: median5 / median7 / median9
+ * -------------------------------------
+ *  Medians of 5, 7 and 9 values with the minimal known exchange networks
+ *  (7, 13 and 19 compare-exchanges). p is reordered.
+ *
+ *  Returns: the median
+ */
+static inline uint16_t median5(uint16_t *p) {
+    SORT2(p[0], p[1]); SORT2(p[3], p[4]); SORT2(p[0], p[3]);
+    SORT2(p[1], p[4]); SORT2(p[1], p[2]); SORT2(p[2], p[3]);
+    SORT2(p[1], p[2]);
+    return p[2];
+}
+
+static inline uint16_t median7(uint16_t *p) {
+    SORT2(p[0], p[5]); SORT2(p[0], p[3]); SORT2(p[1], p[6]);
+    SORT2(p[2], p[4]); SORT2(p[0], p[1]); SORT2(p[3], p[5]);
+    SORT2(p[2], p[6]); SORT2(p[2], p[3]); SORT2(p[3], p[6]);
+    SORT2(p[4], p[5]); SORT2(p[1], p[4]); SORT2(p[1], p[3]);
+    SORT2(p[3], p[4]);
+    return p[3];
+}
+
+static inline uint16_t median9(uint16_t *p) {
+    SORT2(p[1], p[2]); SORT2(p[4], p[5]); SORT2(p[7], p[8]);
+    SORT2(p[0], p[1]); SORT2(p[3], p[4]); SORT2(p[6], p[7]);
+    SORT2(p[1], p[2]); SORT2(p[4], p[5]); SORT2(p[7], p[8]);
+    SORT2(p[0], p[3]); SORT2(p[5], p[8]); SORT2(p[4], p[7]);
+    SORT2(p[3], p[6]); SORT2(p[1], p[4]); SORT2(p[2], p[5]);
+    SORT2(p[4], p[7]); SORT2(p[4], p[2]); SORT2(p[6], p[4]);
+    SORT2(p[4], p[2]);
+    return p[4];
+}
+
+/* 
+ * Function: median_filter_hist
+ * ----------------------------
+ *  Sliding histogram median for wide windows. A 64 bin coarse histogram
+ *  (top 6 bits) is updated with the sample entering and leaving the window
+ *  and tracks which bin holds the median. The exact value is then selected
+ *  among the few window samples that fall in that bin. Ends replicate the
+ *  first and last sample.
+ *
+ *  x: input array
+ *  y: output array
+ *  x_size: size of arrays
+ *  width: window width (odd, 1..MEDIAN_MAX_WIDTH)
+ *
+ *  Returns: void
+ */
+void median_filter_hist(uint16_t *x, uint16_t *y, int x_size, int width) {
+    uint8_t hist[MEDIAN_HIST_BINS];
+    uint16_t v[MEDIAN_MAX_WIDTH];
+    int half = width / 2;
+    int bin = 0;        // bin holding the median
+    int below = 0;      // samples in bins below it
+
+    for (int b = 0; b < MEDIAN_HIST_BINS; b++) {
+        hist[b] = 0;
+    }
+    for (int j = -half; j <= half; j++) {
+        int k = (j < 0) ? 0 : ((j >= x_size) ? x_size - 1 : j);
+        hist[x[k] >> MEDIAN_HIST_SHIFT]++;
+    }
+
+    for (int i = 0; i < x_size; i++) {
+        int first = i - half;
+        int last = i + half;
+
+        if (i > 0) {
+            int out = x[(first - 1 < 0) ? 0 : first - 1] >> MEDIAN_HIST_SHIFT;
+            int in = x[(last >= x_size) ? x_size - 1 : last] >> MEDIAN_HIST_SHIFT;
+            hist[out]--;
+            if (out < bin) {
+                below--;
+            }
+            hist[in]++;
+            if (in < bin) {
+                below++;
+            }
+        }
+
+        // move to the bin with below <= half < below + hist[bin]
+        while (below > half) {
+            bin--;
+            below -= hist[bin];
+        }
+        while (below + hist[bin] <= half) {
+            below += hist[bin];
+            bin++;
+        }
+
+        // select rank (half - below) among the samples in that bin
+        int n = 0;
+        for (int j = first; j <= last; j++) {
+            uint16_t value = x[(j < 0) ? 0 : ((j >= x_size) ? x_size - 1 : j)];
+            if ((value >> MEDIAN_HIST_SHIFT) == bin) {
+                int k = n++;
+                while ((k > 0) && (v[k-1] > value)) {
+                    v[k] = v[k-1];
+                    k--;
+                }
+                v[k] = value;
+            }
+        }
+        y[i] = v[half - below];
+    }
+}
+
+/* 
+ * Function: median_filter_wide
+ * ----------------------------
+ *  Median filter of configurable width. Widths up to 9 use branch-free
+ *  sorting networks, wider windows the sliding histogram. Ends replicate the
+ *  first and last sample (unlike median_filter, which takes the min/max of the
+ *  two end samples).
+ *
+ *  x: input array
+ *  y: output array
+ *  x_size: size of arrays
+ *  width: window width (odd, 1..MEDIAN_MAX_WIDTH)
+ *
+ *  Returns: void
+ */
+void median_filter_wide(uint16_t *x, uint16_t *y, int x_size, int width) {
+    uint16_t p[9];
+    int half = width / 2;
+
+    if (width > 9) {
+        median_filter_hist(x, y, x_size, width);
+        return;
+    }
+
+    for (int i = 0; i < x_size; i++) {
+        if ((i >= half) && (i < x_size - half)) {
+            for (int j = 0; j < width; j++) {
+                p[j] = x[i - half + j];
+            }
+        }
+        else {
+            for (int j = 0; j < width; j++) {
+                int k = i - half + j;
+                p[j] = x[(k < 0) ? 0 : ((k >= x_size) ? x_size - 1 : k)];
+            }
+        }
+
+        switch (width) {
+            case 3:  y[i] = median3(p[0], p[1], p[2]); break;
+            case 5:  y[i] = median5(p); break;
+            case 7:  y[i] = median7(p); break;
+            case 9:  y[i] = median9(p); break;
+            default: y[i] = p[0]; break;
+        }
+    }
+}
+
+/* 
+ * Function: isqrt32
+ * -----------------
+ *  Integer square root, bit by bit (16 iterations, no division).
+ *
+ *  n: input value
+ *
+ *  Returns: floor(sqrt(n))
+ */
+uint32_t isqrt32(uint32_t n) {
+    uint32_t root = 0;
+    uint32_t bit = 1UL << 30;
+
+    while (bit > n) {
+        bit >>= 2;
+    }
+    while (bit != 0) {
+        if (n >= root + bit) {
+            n -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return root;
+}
+
+/* 
+ * Function: signal_stats
+ * ----------------------
+ *  Mean and sample standard deviation of a signal in one integer pass, from
+ *  the sum and sum of squares. Matches the two pass pow()/sqrt() version:
+ *  the mean is truncated first and the deviation is taken around it,
+ *  floor(sqrt(sum((x - mean)^2) / (n - 1))).
+ *
+ *  x: input array
+ *  x_size: size of array (> 1)
+ *  mean: output mean
+ *  stdev: output standard deviation
+ *
+ *  Returns: void
+ */
+void signal_stats(int16_t *x, int x_size, int *mean, int *stdev) {
+    int32_t sum = 0;
+    int64_t sum_sq = 0;
+
+    for (int i = 0; i < x_size; i++) {
+        int32_t v = x[i];
+        sum += v;
+        sum_sq += v * v;
+    }
+
+    int32_t m = sum / x_size;
+
+    // sum((x - m)^2) = sum(x^2) - 2 m sum(x) + n m^2
+    int64_t diff = sum_sq - 2 * (int64_t) m * sum + (int64_t) x_size * m * m;
+    int64_t var = diff / (x_size - 1);
+
+    *mean = m;
+    *stdev = isqrt32((var > 0xFFFFFFFF) ? 0xFFFFFFFF : (uint32_t) var);
+}
+
+/* 
+ * Function: peak_subpixel
+ * -----------------------
+ *  Sub-pixel position of the derivative peak (or trough) an edge detector
+ *  hit at index i. Climbs to the local extremum of the same sign, then fits
+ *  a parabola through it and its two neighbours:
+ *    offset = (y[-1] - y[+1]) / (2 (y[-1] - 2 y[0] + y[+1]))
+ *
+ *  x: derivative signal
+ *  x_size: size of array
+ *  i: index of the edge (threshold crossing)
+ *
+ *  Returns: peak position in pixels, fixed point with SUBPIXEL_SHIFT
+ *           fraction bits
+ */
+int32_t peak_subpixel(int16_t *x, int x_size, int i) {
+    int32_t sign = (x[i] < 0) ? -1 : 1;
+
+    while ((i > 0) && (sign * x[i-1] > sign * x[i])) {
+        i--;
+    }
+    while ((i < x_size - 1) && (sign * x[i+1] > sign * x[i])) {
+        i++;
+    }
+    if ((i == 0) || (i == x_size - 1)) {
+        return (int32_t) i << SUBPIXEL_SHIFT;
+    }
+
+    int32_t a = sign * x[i-1];
+    int32_t b = sign * x[i];
+    int32_t c = sign * x[i+1];
+    int32_t curve = a - 2 * b + c;      // <= 0 at a maximum
+    if (curve == 0) {
+        return (int32_t) i << SUBPIXEL_SHIFT;
+    }
+
+    // |offset| <= 1/2 since b is the largest of the three
+    int32_t offset = ((a - c) * (1 << (SUBPIXEL_SHIFT - 1))) / curve;
+    return ((int32_t) i << SUBPIXEL_SHIFT) + offset;
+}
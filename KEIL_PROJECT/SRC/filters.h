@@ -1,6 +1,43 @@
 #ifndef  FILTERS_H_
 #define  FILTERS_H_
+
+// Use the Cortex-M4 DSP extension (packed halfword / dual MAC)
+// in filter_fused_simd, scalar filter_fused otherwise
+#if defined(__ARM_FEATURE_DSP) || defined(__TARGET_FEATURE_DSPMUL)
+#define  FILTERS_USE_SIMD    1
+#else
+#define  FILTERS_USE_SIMD    0
+#endif
+
+// Widest median_filter_wide window and the coarse histogram
+// used for windows wider than 9 (64 bins of 1024 counts)
+#define  MEDIAN_MAX_WIDTH    31
+#define  MEDIAN_HIST_SHIFT   10
+#define  MEDIAN_HIST_BINS    64
+
+// Fraction bits of the peak_subpixel edge positions
+#define  SUBPIXEL_SHIFT      8
+
+// State of an incremental filter_fused run (filter_stream_*)
+typedef struct {
+    uint16_t x_old, x[2];   // last three samples
+    uint32_t m[5];          // last five medians
+    uint16_t w_old2, w_old1;// last two weighted averages
+    int count;              // samples pushed
+    int16_t *y;             // derivative output
+} FilterStream;
+
 void der_convolve(uint16_t *x, int16_t *h, int16_t *y, int xSize, int hSize, int correction);
 void convolve(uint16_t *x, int16_t *h, uint16_t *y, int xSize, int hSize, int correction);
 void median_filter(uint16_t *x, uint16_t *y, int x_size);
+void median_filter_wide(uint16_t *x, uint16_t *y, int x_size, int width);
+void median_filter_hist(uint16_t *x, uint16_t *y, int x_size, int width);
+void filter_fused(uint16_t *x, int16_t *y, int x_size);
+void filter_fused_simd(uint16_t *x, int16_t *y, int x_size);
+void filter_stream_start(FilterStream *s, int16_t *y);
+void filter_stream_push(FilterStream *s, uint16_t sample);
+void filter_stream_finish(FilterStream *s);
+uint32_t isqrt32(uint32_t n);
+void signal_stats(int16_t *x, int x_size, int *mean, int *stdev);
+int32_t peak_subpixel(int16_t *x, int x_size, int i);
 #endif  /*  ifndef  FILTERS_H_  */
@@ -0,0 +1,89 @@
+/*
+ * Speed and curvature scheduled steering gains
+ *
+ * The steering PID gains come from a table over commanded
+ * speed (motor duty, percent) and curvature (the planner's
+ * estimate, 0 straight .. 1 tightest, planner.c), with
+ * bilinear interpolation between the points. Faster rows
+ * trade proportional gain for damping, which keeps the
+ * fast profile from oscillating; the curve columns raise
+ * KP so the car turns in quicker.
+ *
+ * The 54% straight entry is the original fixed tuning
+ * (KP 4.25, KI 0, KD 2.0).
+ *
+ * File:    gains.c
+ * Authors: Seth Deane & Brian Powers
+ * Created: April 20 2019
+ */
+
+#include "MK64F12.h"
+#include "gains.h"
+
+// Table axes: speed from SPEED_FIRST in SPEED_STEP steps,
+//  curvature from 0 in CURVE_STEP steps
+#define SPEED_POINTS        3
+#define SPEED_FIRST         54.0f
+#define SPEED_STEP          8.0f
+#define CURVE_POINTS        3
+#define CURVE_STEP          0.5f
+
+// {KP, KI, KD} per speed (rows) and curvature (columns)
+static const Gains gain_table[SPEED_POINTS][CURVE_POINTS] = {
+    // 0                   .5                  1
+    {{4.25f, 0.0f, 2.0f}, {4.5f, 0.0f, 2.0f}, {5.0f, 0.0f, 2.0f}},    // 54 %
+    {{3.8f,  0.0f, 2.3f}, {4.1f, 0.0f, 2.3f}, {4.6f, 0.0f, 2.2f}},    // 62 %
+    {{3.4f,  0.0f, 2.6f}, {3.7f, 0.0f, 2.6f}, {4.2f, 0.0f, 2.4f}},    // 70 %
+};
+
+/* Function: axis_position
+ * -----------------------
+ *  Splits a value into a table index and the fraction
+ *  towards the next point, clamped to the table.
+ */
+static int axis_position(float x, float first, float step, int points, float* frac) {
+    float pos = (x - first) / step;
+    if (pos <= 0.0f) {
+        *frac = 0.0f;
+        return 0;
+    }
+    if (pos >= (float) (points - 1)) {
+        *frac = 0.0f;
+        return points - 1;
+    }
+    int i = (int) pos;
+    *frac = pos - (float) i;
+    return i;
+}
+
+/* Function: Gains_Lookup
+ * ----------------------
+ *  Interpolates the steering gains.
+ *
+ *  speed: commanded motor duty (percent)
+ *  curvature: planner curvature estimate (0..1)
+ *  gains: output gains
+ *
+ *  Returns: void
+ */
+void Gains_Lookup(float speed, float curvature, Gains* gains) {
+    float fs, fc;
+    int s = axis_position(speed, SPEED_FIRST, SPEED_STEP, SPEED_POINTS, &fs);
+    int c = axis_position(curvature, 0.0f, CURVE_STEP, CURVE_POINTS, &fc);
+    int s1 = (s + 1 < SPEED_POINTS) ? s + 1 : s;
+    int c1 = (c + 1 < CURVE_POINTS) ? c + 1 : c;
+
+    const Gains* g00 = &gain_table[s][c];
+    const Gains* g01 = &gain_table[s][c1];
+    const Gains* g10 = &gain_table[s1][c];
+    const Gains* g11 = &gain_table[s1][c1];
+
+    float w00 = (1.0f - fs) * (1.0f - fc);
+    float w01 = (1.0f - fs) * fc;
+    float w10 = fs * (1.0f - fc);
+    float w11 = fs * fc;
+
+    gains->kp = w00 * g00->kp + w01 * g01->kp + w10 * g10->kp + w11 * g11->kp;
+    gains->ki = w00 * g00->ki + w01 * g01->ki + w10 * g10->ki + w11 * g11->ki;
+    gains->kd = w00 * g00->kd + w01 * g01->kd + w10 * g10->kd + w11 * g11->kd;
+}
@@ -0,0 +1,10 @@
+#ifndef  GAINS_H_
+#define  GAINS_H_
+
+// Steering gains, per control period like the old KP/KI/KD
+typedef struct {
+    float kp, ki, kd;
+} Gains;
+
+void Gains_Lookup(float speed, float curvature, Gains* gains);
+#endif  /*  ifndef  GAINS_H_  */
@@ -0,0 +1,229 @@
+/*
+ * Lap map learning
+ *
+ * The track is the same every lap. Between the first two
+ * start/finish lines the car records, per distance bin, the
+ * planner's curvature estimate and the steering it used.
+ * When the lap closes the curvature is turned into a braking
+ * profile: walking the lap backwards, each bin keeps at least
+ * the curvature of the bins after it minus BRAKE_PER_BIN, so
+ * the planned speed comes down before a corner instead of in
+ * it. Later laps look the profile and steering up ahead of the
+ * car's position.
+ *
+ * Distance is odometry from the measured wheel speed
+ * (speed.c, percent of full speed x seconds), or from the
+ * motor duty in the same units without encoders. It drifts
+ * over a lap, so every start/finish line puts the position
+ * back to 0.
+ *
+ * File:    lapmap.c
+ * Authors: Seth Deane & Brian Powers
+ * Created: April 23 2019
+ */
+
+#include "MK64F12.h"
+#include "camera.h"
+#include "lapmap.h"
+
+// Distance per map bin (speed percent x seconds), and the
+//  longest lap the map can hold
+#define BIN_LENGTH          4.0f
+#define MAP_BINS            512
+// Shorter laps are a marker seen twice, not a lap
+#define MIN_BINS            16
+
+// Curvature (Q8) a bin may drop per bin towards a corner
+#define BRAKE_PER_BIN       16
+
+// Bins looked ahead for the speed (braking takes effect
+//  late) and for the steering (servo lag)
+#define PREVIEW_BINS        2
+#define STEER_BINS          1
+
+#define Q8_ONE              256
+
+// Learning lap sums per bin
+static float curve_sum[MAP_BINS];
+static float steer_sum[MAP_BINS];
+static uint16_t samples[MAP_BINS];
+
+// The map: planned curvature (Q8, 0..255) and steering
+//  (servo_turn offset, -64..64)
+static uint8_t profile[MAP_BINS];
+static int8_t steering[MAP_BINS];
+static int lap_bins = 0;
+
+static int state = LAPMAP_WAIT;
+static float distance = 0.0f;
+
+/* Function: current_bin
+ * ---------------------
+ *  Bin of the position plus a look ahead, wrapped around
+ *  the lap.
+ */
+static int current_bin(int ahead) {
+    int bin = (int) (distance / BIN_LENGTH) + ahead;
+    return bin % lap_bins;
+}
+
+/* Function: learn_start
+ * ---------------------
+ *  Clears the sums and starts recording at this line.
+ */
+static void learn_start(void) {
+    for (int i = 0; i < MAP_BINS; i++) {
+        curve_sum[i] = 0.0f;
+        steer_sum[i] = 0.0f;
+        samples[i] = 0;
+    }
+    distance = 0.0f;
+    state = LAPMAP_LEARN;
+}
+
+/* Function: learn_finish
+ * ----------------------
+ *  Closes the learning lap: averages the bins, fills bins
+ *  the car went through within a frame from the one before,
+ *  and builds the braking profile.
+ *
+ *  Returns: 1 if the lap made a map, 0 if it was too short
+ */
+static int learn_finish(void) {
+    int bins = (int) (distance / BIN_LENGTH) + 1;
+    if (bins < MIN_BINS) {
+        return 0;
+    }
+    if (bins > MAP_BINS) {
+        bins = MAP_BINS;
+    }
+    lap_bins = bins;
+
+    int curve = 0;
+    int steer = 0;
+    for (int i = 0; i < lap_bins; i++) {
+        if (samples[i] > 0) {
+            curve = (int) ((float) Q8_ONE * curve_sum[i] / (float) samples[i]);
+            steer = (int) (steer_sum[i] / (float) samples[i]);
+        }
+        if (curve > Q8_ONE - 1) {
+            curve = Q8_ONE - 1;
+        }
+        if (steer > 64) {
+            steer = 64;
+        } else if (steer < -64) {
+            steer = -64;
+        }
+        profile[i] = (uint8_t) curve;
+        steering[i] = (int8_t) steer;
+    }
+
+    // Brake ahead of the corners. Two passes backwards so a
+    //  corner just after the line reaches the end of the lap.
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = lap_bins - 1; i >= 0; i--) {
+            int next = profile[(i + 1) % lap_bins] - BRAKE_PER_BIN;
+            if (next > profile[i]) {
+                profile[i] = (uint8_t) next;
+            }
+        }
+    }
+    return 1;
+}
+
+/* Function: LapMap_Reset
+ * ----------------------
+ *  Forgets the map, learns again from the next start/finish
+ *  line (start of a run).
+ *
+ *  Returns: void
+ */
+void LapMap_Reset(void) {
+    state = LAPMAP_WAIT;
+    distance = 0.0f;
+    lap_bins = 0;
+}
+
+/* Function: LapMap_Update
+ * -----------------------
+ *  Advances the odometry by one loop period and records
+ *  or localizes.
+ *
+ *  finish: nonzero if a start/finish line was passed
+ *  speed: wheel speed this period (percent, or motor duty)
+ *  curvature: planner curvature estimate (0..1)
+ *  steer: servo_turn offset from center (-64..64)
+ *  dt: loop period (seconds)
+ *
+ *  Returns: 1 if this line completed a lap, 0 otherwise (the
+ *      first line, or the same line seen twice)
+ */
+int LapMap_Update(int finish, float speed, float curvature, float steer, float dt) {
+    if (finish) {
+        if (state == LAPMAP_WAIT) {
+            learn_start();
+        } else if (state == LAPMAP_LEARN) {
+            if (learn_finish()) {
+                state = LAPMAP_RACE;
+                distance = 0.0f;
+                return 1;
+            }
+            learn_start();
+        } else if (distance > (float) lap_bins * BIN_LENGTH / 2.0f) {
+            // back at the line (closer ones are the same line
+            //  seen twice; without a map every line counts)
+            distance = 0.0f;
+            return 1;
+        }
+        return 0;
+    }
+
+    distance += speed * dt;
+
+    if (state == LAPMAP_LEARN) {
+        int bin = (int) (distance / BIN_LENGTH);
+        if (bin >= MAP_BINS) {
+            // lap too long for the map
+            state = LAPMAP_FAILED;
+        } else {
+            curve_sum[bin] += curvature;
+            steer_sum[bin] += steer;
+            samples[bin]++;
+        }
+    }
+    return 0;
+}
+
+/* Function: LapMap_State
+ * ----------------------
+ *  Returns: the map state
+ */
+int LapMap_State(void) {
+    return state;
+}
+
+/* Function: LapMap_Preview
+ * ------------------------
+ *  Planned curvature just ahead of the car.
+ *
+ *  Returns: curvature (0..1), or -1 if not racing on the map
+ */
+float LapMap_Preview(void) {
+    if (state != LAPMAP_RACE) {
+        return -1.0f;
+    }
+    return (float) profile[current_bin(PREVIEW_BINS)] / (float) Q8_ONE;
+}
+
+/* Function: LapMap_Steer
+ * ----------------------
+ *  Steering recorded just ahead of the car, for feed-forward.
+ *
+ *  Returns: servo_turn offset (-64..64), 0 if not racing
+ */
+float LapMap_Steer(void) {
+    if (state != LAPMAP_RACE) {
+        return 0.0f;
+    }
+    return (float) steering[current_bin(STEER_BINS)];
+}
@@ -0,0 +1,15 @@
+#ifndef  LAPMAP_H_
+#define  LAPMAP_H_
+
+// Map states
+#define LAPMAP_WAIT         0   // before the first start/finish line
+#define LAPMAP_LEARN        1   // recording the first lap
+#define LAPMAP_RACE         2   // map ready, following it
+#define LAPMAP_FAILED       3   // lap did not fit, stay reactive
+
+void LapMap_Reset(void);
+int LapMap_Update(int finish, float speed, float curvature, float steer, float dt);
+int LapMap_State(void);
+float LapMap_Preview(void);
+float LapMap_Steer(void);
+#endif  /*  ifndef  LAPMAP_H_  */
@@ -10,12 +10,27 @@
 #include "MK64F12.h"
 #include "filters.h"
 #include "camera.h"
+#include "exposure.h"
+#include "calibration.h"
+#include "benchmark.h"
+#include "pipeline.h"
+#include "edges.h"
+#include "tracker.h"
+#include "markers.h"
+#include "safety.h"
+#include "scheduler.h"
+#include "pid.h"
+#include "gains.h"
+#include "differential.h"
+#include "planner.h"
+#include "lapmap.h"
+#include "speed.h"
+#include "encoder.h"
 #include "common.h"
 #include "stdlib.h"
 #include "main.h"
 #include "uart.h"
 #include "pwm.h"
-#include "math.h"
 
 // Common Static Values
 #define     ONE_TWENTY_EIGHT    128
@@ -24,44 +39,67 @@
 #define     MAX_MARGIN          8
 
 // Servo ranges
-#define     SERVO_MIN           4.5
-#define     SERVO_MID           7.25
-#define     SERVO_MAX           9
+#define     SERVO_MIN           4.5f
+#define     SERVO_MID           7.25f
+#define     SERVO_MAX           9.0f
 
 // Motor Ranges
 #define     MOTOR_MAX           70
 #define     MOTOR_MIN           35
 
-// PID Values
-#define     KP                  4.25
-#define     KI                  0.0
-#define     KD                  2.0
+// PID Values: KP, KI and KD are scheduled on speed and
+// curvature (gains.c). Cutoff of the derivative low-pass (Hz)
+#define     KD_CUTOFF           20.0f
 
 // Debugging variables (1 = Debug True)
 #define     CAM_DEBUG           0
 #define     SER_DEBUG           0
-
-// Structure to hold the greatest and smallest value from the camera array.
-// Left is the smaller index, Right is the larger index.
-struct greaterSmaller {
- int left, right;
-};
-
-typedef struct greaterSmaller Struct;
-Struct left_right_index(int16_t* array, int old_calculated_middle);
+// Print kernel cycle benchmarks over UART at startup
+#define     BENCHMARK           0
+
+// Auto-exposure (1 = adjust integration time every frame)
+#define     AUTO_EXPOSURE       1
+
+// Closed-loop wheel speed (1 = encoders fitted, the motor
+// duties become speed setpoints). Leave at 0 until FULL_SPEED
+// and the gains in speed.c are measured on the car.
+#define     SPEED_LOOP          0
+
+// Stop after this many start/finish lines (0 = never stop).
+// The car starts behind the line, so one lap passes it twice.
+#define     FINISH_LINES        2
+
+// Laps raced on the lap map after the first (learning) lap.
+// With MAP_LAPS set the run ends after 1 + MAP_LAPS laps as
+// the lap map counts them (FINISH_LINES 0 still never
+// stops). The learning lap runs MAP_LEARN_SLOW
+// duty percent under the straight speed. Feed-forward weight
+// of the recorded steering.
+#define     MAP_LAPS            0
+#define     MAP_LEARN_SLOW      8
+#define     MAP_STEER_FF        0.5f
 
 int main(void)
 {
     // Initialize UART and PWM
     initialize();
 
+    if (BENCHMARK) {
+        Benchmark_Run();
+    }
+
     // Array holding the 128 length array containing camera signal
     uint16_t* camera_sig;
+    CameraFrame frame;
 
-    // Initialize variables for PID control
-    double servo_turn_old = 64.0;
-    double servo_err_old1 = 0.0;
-    double servo_err_old2 = 0.0;
+    // Steering PID, output is the servo_turn offset from the
+    // center (servo_turn spans 0..128 over the servo range)
+    // (gains are set every frame from the schedule)
+    Pid steer_pid;
+    Gains gains;
+    Pid_Init(&steer_pid, 0.0f, 0.0f, 0.0f, SCHEDULER_PERIOD, KD_CUTOFF, \
+             -SIXTY_FOUR, SIXTY_FOUR);
+    float servo_turn_old = 64.0f;
 
     // Initialize the starting duty cycle
     int motor_duty_left = MOTOR_MAX;
@@ -71,13 +109,18 @@ int main(void)
     int motor_max = MOTOR_MAX;
     int motor_min = MOTOR_MIN;
 
-    int old_calculated_middle = SIXTY_FOUR;
+    int32_t old_middle_sub = SIXTY_FOUR << SUBPIXEL_SHIFT;
 
     // all LED colors off
     GPIOE_PSOR = (1UL << 26);
     GPIOB_PSOR = (1UL << 21);
     GPIOB_PSOR = (1UL << 22);
 
+    // Hold SW2 at power up to calibrate the cameras
+    if ((GPIOC_PDIR & (1 << 6)) == 0) {
+        calibrate();
+    }
+
     // White
     GPIOE_PCOR = (1UL << 26);
     GPIOB_PCOR = (1UL << 21);
@@ -129,81 +172,209 @@ int main(void)
                 motor_max = MOTOR_MAX - 16;
                 motor_min = MOTOR_MIN - 16;
             }
+
+            // Edges unknown until the first detections
+            Edges_Reset();
+            Tracker_Reset(0, (ONE_TWENTY_EIGHT - 1) << SUBPIXEL_SHIFT);
+            old_middle_sub = SIXTY_FOUR << SUBPIXEL_SHIFT;
+            Markers_Reset();
+            Safety_Reset();
+            Scheduler_ClearStats();
+            Pid_Reset(&steer_pid);
+            servo_turn_old = 64.0f;
+            Planner_Reset((float) motor_min);
+            LapMap_Reset();
+            int finish_lines = 0;
+            int laps = 0;
+
             while(1){
 
-                // Read Trace Camera
-                camera_sig = Camera_Main();
+                // Wait for the next control period (fixed rate) and
+                // the camera line that follows it, so each stage and
+                // the PID update run once per period on a new line
+                // (once per frame if the exposure is longer, dt is
+                // the time actually covered)
+                int fresh = Scheduler_Wait(&frame);
+                float dt = Scheduler_Dt();
+                camera_sig = frame.line;
+
+                // Track venue lighting (on the raw line, its levels
+                // are ADC headroom; a stale line is already corrected)
+                if (AUTO_EXPOSURE && fresh) {
+                    Exposure_Update(&frame);
+                }
 
-                // Filter linescan camera signal
-                int16_t deriv_sig[ONE_TWENTY_EIGHT];
-                filter_main(camera_sig, deriv_sig);
+                // Remove per-pixel offsets and lens roll-off (in
+                // place, a stale frame was already corrected). The
+                // streaming filter corrects its samples on its own,
+                // but the line is still raw for the stages below.
+                if (fresh) {
+                    Calibration_Apply(camera_sig, 0);
+                }
 
-                // Calculate center of track
-                Struct edge_index = left_right_index(deriv_sig, old_calculated_middle);
-                int calculated_middle = ((edge_index.right - edge_index.left)/2) + edge_index.left;
-                int middle_delta = abs(SIXTY_FOUR - calculated_middle);
+                // A stale line was measured last iteration already:
+                // no edges or markers from it, the tracker only
+                // predicts and the safety state holds
+                EdgePair edges = {0};
+                int markers = 0;
+                if (fresh) {
+                    // Filter linescan camera signal, unless the capture
+                    // ISR already did (streaming filter)
+                    int16_t deriv_buf[ONE_TWENTY_EIGHT];
+                    int16_t* deriv_sig = frame.deriv;
+                    if (deriv_sig == 0) {
+                        filter_main(camera_sig, deriv_buf);
+                        deriv_sig = deriv_buf;
+                    }
+
+                    // Pick the best scoring pair of track edges
+                    Edges_Find(deriv_sig, old_middle_sub, &edges);
+
+                    // Start/finish line and crossings, checked between
+                    // the tracked edges
+                    markers = Markers_Update(camera_sig, deriv_sig, \
+                                             Tracker_Position(TRACK_LEFT), \
+                                             Tracker_Position(TRACK_RIGHT));
+                    if (markers & MARKER_FINISH) {
+                        finish_lines++;
+                    }
+                }
 
-                // Perform PID calculations
-                double servo_err = (double) SIXTY_FOUR - (double) calculated_middle;
-                double servo_turn = servo_turn_old - \
-                                   (double) KP * (servo_err-servo_err_old1) - \
-                                   (double) KI * (servo_err+servo_err_old1)/2 - \
-                                   (double) KD * (servo_err - 2*servo_err_old1 + servo_err_old2);
+                // Fuse into the edge tracker, which predicts through
+                // frames where an edge is missing (or a crossing
+                // hides the borders)
+                int edge_weight = edges.confidence * TRACK_WEIGHT_ONE / EDGE_CONF_ONE;
+                if (markers & MARKER_CROSSING) {
+                    edge_weight = 0;
+                }
+                Tracker_Update(edges.left_sub, edges.left_found ? edge_weight : 0, \
+                               edges.right_sub, edges.right_found ? edge_weight : 0);
+
+                // Slow down and stop when the track is lost (a crossing
+                // hides the borders on purpose, so it doesn't count)
+                int safety_state = Safety_State();
+                if (fresh && !(markers & MARKER_CROSSING)) {
+                    safety_state = Safety_Update(edges.confidence * SAFETY_CONF_ONE / EDGE_CONF_ONE);
+                }
 
-                // convert to a number usable by the servos
-                double servo_range = (double) SERVO_MAX - (double) SERVO_MIN;
-                double range_mult = (double) ONE_TWENTY_EIGHT / servo_range;
-                double servo_duty = (double) SERVO_MIN + (servo_turn / (double) range_mult);
+                // Sub-pixel track center for the steering error
+                int32_t middle_sub = Tracker_Middle();
+                int calculated_middle = middle_sub >> SUBPIXEL_SHIFT;
+                int middle_delta = abs(SIXTY_FOUR - calculated_middle);
 
-                // convert to a number useable for rear differential turning
-                double middle_servo_offset = servo_duty - (double) SERVO_MIN;
-                int middle_servo_percent = 100 * (middle_servo_offset / servo_range);
-                int abs_motor_percent = abs(25 - (middle_servo_percent/2));
+                // Target speed from the curvature ahead: the near
+                // center history, and the far camera when fitted
+                // (once its lines look like track, planner.c)
+                float far_middle = -1.0f;
+                if (CAMERA_COUNT > 1) {
+                    if (fresh) {
+                        Calibration_Apply(frame.lines[CAMERA_COUNT - 1], CAMERA_COUNT - 1);
+                        far_middle = Planner_FarCenter(frame.lines[CAMERA_COUNT - 1]);
+                    }
+                }
+                // (learning lap a bit slower, later laps planned
+                // from the lap map, or reactive if it failed)
+                float speed_max = (float) motor_max;
+                int map_state = LapMap_State();
+                if ((MAP_LAPS > 0) && \
+                    ((map_state == LAPMAP_WAIT) || (map_state == LAPMAP_LEARN))) {
+                    speed_max -= MAP_LEARN_SLOW;
+                }
+                float target_speed = Planner_Update((float) middle_sub / (float) (1 << SUBPIXEL_SHIFT), \
+                                                    far_middle, LapMap_Preview(), \
+                                                    speed_max, (float) motor_min, dt);
 
-                // TURN ALL THE WAY RIGHT
-                if (servo_duty > SERVO_MAX)
-                {
-                    SetServoDutyCycle(SERVO_MAX);
-                    motor_duty_left = (motor_max + motor_min) / 2;
-                    motor_duty_right = motor_min - 8;
+                // Perform PID calculations
+                float servo_err = (float) SIXTY_FOUR - \
+                                  (float) middle_sub / (float) (1 << SUBPIXEL_SHIFT);
+                float servo_turn;
+
+                // Schedule the gains on the commanded speed and on the
+                // planner's curvature estimate (tuned per nominal
+                // period), over the period this iteration covers
+                Gains_Lookup(target_speed, Planner_Curvature(), &gains);
+                Pid_SetGains(&steer_pid, gains.kp, gains.ki / SCHEDULER_PERIOD, \
+                             gains.kd * SCHEDULER_PERIOD);
+                Pid_SetDt(&steer_pid, dt);
+
+                // Hold the steering while crossing an intersection, or
+                // the last good steering while the track is not seen
+                // (the PID skips those samples, so its derivative
+                // restarts from the first error after the hold)
+                if ((markers & MARKER_CROSSING) || (safety_state != SAFETY_NORMAL)) {
+                    servo_turn = servo_turn_old;
+                    Pid_ResetDerivative(&steer_pid);
+                } else {
+                    servo_turn = (float) SIXTY_FOUR - Pid_Update(&steer_pid, servo_err) + \
+                                 MAP_STEER_FF * LapMap_Steer();
                 }
-                // TURN ALL THE WAY LEFT
-                else if (servo_duty < SERVO_MIN)
-                {
-                    SetServoDutyCycle(SERVO_MIN);
-                    motor_duty_left = motor_min - 8;
-                    motor_duty_right = (motor_max + motor_min) / 2;
+
+                // convert to a number usable by the servos
+                float servo_range = SERVO_MAX - SERVO_MIN;
+                float range_mult = (float) ONE_TWENTY_EIGHT / servo_range;
+                float servo_duty = SERVO_MIN + (servo_turn / range_mult);
+
+                // Steer, clamped to the servo range
+                if (servo_duty > SERVO_MAX) {
+                    servo_duty = SERVO_MAX;
+                } else if (servo_duty < SERVO_MIN) {
+                    servo_duty = SERVO_MIN;
                 }
-                else
-                {
-                    SetServoDutyCycle(servo_duty);
-                    motor_duty_left = motor_max - abs_motor_percent;
-                    motor_duty_right = motor_max - abs_motor_percent;
+                SetServoDutyCycle(servo_duty);
+
+                // Planned speed, never below the corner speed
+                int motor_duty = (int) target_speed;
+                if (motor_duty < motor_min) {
+                    motor_duty = motor_min;
                 }
 
-                // Turn on motors
-               SetMotorDutyCycleL(motor_duty_left, 10000, 1);
-               SetMotorDutyCycleR(motor_duty_right, 10000, 1);
+                // Split the rear wheels for the turn radius (the
+                // outer wheel gets the full duty)
+                Differential_Split(servo_duty, motor_duty, &motor_duty_left, &motor_duty_right);
+
+                // Wheel speeds for the speed loop (ramped down outside
+                // SAFETY_NORMAL)
+                Speed_Set((float) Safety_ScaleDuty(motor_duty_left), \
+                          (float) Safety_ScaleDuty(motor_duty_right));
+
+                // Lap map odometry (measured wheel speed, or the
+                // duty without encoders), record or follow the map
+                if (MAP_LAPS > 0) {
+                    float travel = (float) Safety_ScaleDuty(motor_duty);
+                    if (Speed_ClosedLoop()) {
+                        travel = (Speed_Measured(ENCODER_LEFT) + \
+                                  Speed_Measured(ENCODER_RIGHT)) / 2.0f;
+                    }
+                    laps += LapMap_Update(markers & MARKER_FINISH, travel, \
+                                          Planner_Curvature(), servo_turn - (float) SIXTY_FOUR, dt);
+                }
 
-                // update old servo values
+                // update old servo value
                 servo_turn_old = servo_turn;
-                servo_err_old2 = servo_err_old1;
-                servo_err_old1 = servo_err;
 
                 // update old middle
-                old_calculated_middle = calculated_middle;
+                old_middle_sub = middle_sub;
+
+                // Filter chain changes from UART0
+                Pipeline_Poll();
 
                 // break out if the SW3 is pressed
                 if((GPIOA_PDIR & (1 << 4)) == 0){
                     break;
                 }
+
+                // or once the run is over
+                int run_over = (MAP_LAPS > 0) ? (laps >= 1 + MAP_LAPS) : \
+                                                (finish_lines >= FINISH_LINES);
+                if ((FINISH_LINES > 0) && run_over) {
+                    break;
+                }
             }
         }
         else
         {
             // Stop before next run
-            SetMotorDutyCycleL(0, 10000, 1);
-            SetMotorDutyCycleR(0, 10000, 1);
+            Speed_Set(0.0f, 0.0f);
             SetServoDutyCycle(SERVO_MID);
 
             // Wait to make sure the SW3 is unpressed
@@ -237,6 +408,9 @@ int main(void)
  *  Function that contains all the initialization function.
  */
 void initialize(void) {
+    // Initialize cycle counter (frame timestamps)
+    init_cycle_counter();
+
 	// Initialize UART
 	uart0_init();
 	uart3_init();
@@ -245,77 +419,67 @@ void initialize(void) {
     init_GPIO(); // For CLK and SI output on GPIO
     init_FTM2(); // To generate CLK, SI, and trigger ADC
     init_ADC0();
+    init_ADC1(); // Far camera (CAMERA_COUNT > 1)
+    init_DMA(); // To move CLK edges and ADC samples without the CPU
     init_PIT(); // To trigger camera read based on integration time
+    Scheduler_Init(); // Fixed rate control loop (PIT1)
 
 	// Initialize the FlexTimer
 	init_PWM();
-}
-
-/* Function: left_right_index
- * --------------------------
- *  Find the left and right index of an array.
- *
- *  array: input array
- *
- *  Returns: Struct containing min and max index of track
- */
-Struct left_right_index(int16_t* array, int old_calculated_middle) {
-    Struct s;
 
-    int min_idx = SIXTY_FOUR;
-    int max_idx = SIXTY_FOUR;
+    // Wheel encoders and speed loop (PIT2), motors off
+    Speed_Init(SPEED_LOOP);
 
+    // Filter chain (median, weighted average, derivative)
+    Pipeline_Default();
 
-    // calculate the mean
-    int total = 0;
-    for (int i = 0; i < ONE_TWENTY_EIGHT; i++)
-    {
-        total += array[i];
-    }
-
-//    print_array_s(array, ONE_TWENTY_EIGHT);
-
-    int mean = total / ONE_TWENTY_EIGHT;
+    // Rear wheel split table for the servo range
+    Differential_Init(SERVO_MIN, SERVO_MID, SERVO_MAX);
+}
 
-    // calculate difference squared from mean
-    int difference = 0;
-    for (int i = 0; i < ONE_TWENTY_EIGHT; i++)
-    {
-        difference += pow((array[i] - mean), 2);
-    }
+/*
+ * Function: calibrate
+ * -------------------
+ *  Records the camera calibration references, stepping
+ *  through them with SW3.
+ *   Red:  cover the lenses, press SW3 (dark frame)
+ *   Blue: point the cameras at the white track, press SW3
+ *         (flat frame)
+ *  The LEDs blink purple if the flat frame was not
+ *  brighter than the dark frame (calibration discarded).
+ */
+void calibrate(void) {
+    // Wait to make sure SW2 is unpressed
+    delay(20);
 
-    // calculate standard deviation
-    int stdev = sqrt(difference/(ONE_TWENTY_EIGHT - 1));
+    // RED: dark frame (armed once SW3 is up, so a press
+    // can't run into the next capture)
+    GPIOB_PCOR = (1UL << 22);
+    while ((GPIOA_PDIR & (1 << 4)) == 0);
+    delay(20);
+    while ((GPIOA_PDIR & (1 << 4)) != 0);
+    Calibration_Capture(CAL_DARK);
+    GPIOB_PSOR = (1UL << 22);
 
-    // Print the middle delta as to determine what is usual and what to make the MARGIN
-//    char mid_delta[10000];
-//    sprintf(mid_delta, "%d %d \n\r", mean, stdev);
-//    put(mid_delta);
+    // BLUE: flat frame
+    GPIOB_PCOR = (1UL << 21);
+    while ((GPIOA_PDIR & (1 << 4)) == 0);
+    delay(20);
+    while ((GPIOA_PDIR & (1 << 4)) != 0);
+    Calibration_Capture(CAL_FLAT);
+    GPIOB_PSOR = (1UL << 21);
 
-    int breakmin = 0;
-    for (int c = old_calculated_middle; c < ONE_TWENTY_EIGHT; c++)
-    {
-        if ((array[c] < (mean - stdev)) && (breakmin == 0))
-        {
-            min_idx = c;
-            breakmin = 1;
-        }
-    }
+    // Wait to make sure the SW3 is unpressed (it also starts
+    // the run)
+    while ((GPIOA_PDIR & (1 << 4)) == 0);
+    delay(20);
 
-    int breakmax = 0;
-    for (int c = old_calculated_middle; c > 0; c--)
-    {
-        if ((array[c] > (mean + stdev)) && (breakmax == 0))
-        {
-            max_idx = c;
-            breakmax = 1;
+    if (!Calibration_Compute()) {
+        for (int i = 0; i < 6; i++) {
+            GPIOB_PTOR = (1UL << 21) | (1UL << 22);
+            delay(10);
         }
     }
-
-    s.left = max_idx;
-    s.right = min_idx;
-
-    return s;
 }
 
 /*
@@ -325,7 +489,8 @@ Struct left_right_index(int16_t* array, int old_calculated_middle) {
  *  signal. First filter is a median filter to remove unwanted spikes. Second
  *  filter is a weighted average filter which smooths out signal. Third filter
  *  is a derivative filter which assists in finding left and right sides of the
- *  track.
+ *  track. The chain lives in pipeline.c and can be changed over UART0; by
+ *  default all three run in a single pass (filter_fused_simd).
  *
  *  camera_sig: Diret camera input signal.
  *  deriv_sig: Derivative of smoothed signal.
@@ -334,51 +499,8 @@ Struct left_right_index(int16_t* array, int old_calculated_middle) {
  */
  void filter_main(uint16_t* camera_sig, int16_t* deriv_sig)
  {
-    // step 1) Median filter
-    uint16_t median_sig[ONE_TWENTY_EIGHT];
-    median_filter(camera_sig, median_sig, ONE_TWENTY_EIGHT);
-
-    // print median signal
-    if (CAM_DEBUG) {
-        put("median_sig");
-        print_array_u(median_sig, ONE_TWENTY_EIGHT);
-    }
-
-    // step 2) Weighted average filter
-    int16_t weight_fil[5] = {1,2,4,2,1};
-    uint16_t weight_sig[ONE_TWENTY_EIGHT];
-    convolve(median_sig, \
-             weight_fil, \
-             weight_sig, \
-             ONE_TWENTY_EIGHT, \
-             sizeof(weight_fil)/sizeof(weight_fil[0]), \
-             10);
-
-    // Correct the zeros at the beginning
-    for (int k = 2; k < ONE_TWENTY_EIGHT-2; k++){
-        weight_sig[k] = weight_sig[k+2];
-    }
-
-    // Get get rid of 4 zeros that are created by convolve function
-    weight_sig[0] = weight_sig[2];
-    weight_sig[1] = weight_sig[2];
-    weight_sig[126] = weight_sig[125];
-    weight_sig[127] = weight_sig[125];
-
-    // print clean signal
-    if (CAM_DEBUG) {
-        put("weight_sig");
-        print_array_u(weight_sig, ONE_TWENTY_EIGHT);
-    }
-
-    // step 3) Derivative filter
-    int16_t deriv_fil[3] = {1,0,-1};
-    der_convolve(weight_sig, \
-                 deriv_fil, \
-                 deriv_sig, \
-                 ONE_TWENTY_EIGHT, \
-                 sizeof(deriv_fil)/sizeof(deriv_fil[0]), \
-                 1);
+    // Median, {1,2,4,2,1} weighted average and {1,0,-1} derivative
+    Pipeline_Run(camera_sig, deriv_sig);
 
     // print derivative signal
     if (CAM_DEBUG) {
@@ -1,5 +1,6 @@
 #ifndef  MAIN_H_
 #define  MAIN_H_
 void initialize(void);
+void calibrate(void);
 void filter_main(uint16_t* camera_sig, int16_t* deriv_sig);
 #endif  /*  ifndef  MAIN_H_  */
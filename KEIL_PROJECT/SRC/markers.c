@@ -0,0 +1,181 @@
+/*
+ * Start/finish line and crossing detection
+ *
+ * Looks at the camera line between the tracked edges for
+ * the two track markings:
+ *   - start/finish: dark bars across the track, seen as
+ *     alternating falling/rising edges inside the track, or
+ *     as the track going dark over most of its width
+ *   - crossing: the borders disappear and the line is
+ *     bright over its full width
+ * Levels are relative to the brightness of the plain track,
+ * learned on frames without markings, so they follow the
+ * auto-exposure.
+ *
+ * A signature has to be seen on MARKER_CONFIRM frames in a
+ * row. The finish event then fires once until the line is
+ * behind the car, the crossing flag stays up while the
+ * crossing is in view and CROSSING_HOLD frames after.
+ *
+ * One pass over the line and one over the derivative.
+ *
+ * File:    markers.c
+ * Authors: Seth Deane & Brian Powers
+ * Created: April 16 2019
+ */
+
+#include "MK64F12.h"
+#include "filters.h"
+#include "markers.h"
+
+// Number of pixels in a line
+#define PIXELS              128
+
+// Pixels at the ends of the line left out (lens roll-off)
+#define END_MARGIN          8
+// Pixels next to the edges left out of the track interior
+#define EDGE_MARGIN         3
+
+// Alternating edges inside the track for a finish line
+//  (two dark bars give falling, rising, falling, rising)
+#define FINISH_TRANSITIONS  4
+// Inside edges need a step of at least track level / 4
+#define STEP_SHIFT          2
+// Dark track fraction for a finish line (3/4)
+#define DARK_NUM            3
+#define DARK_DEN            4
+// Bright line fraction for a crossing (31/32, no border
+//  line left in view)
+#define BRIGHT_NUM          31
+#define BRIGHT_DEN          32
+
+// Frames a signature must last before it counts
+#define MARKER_CONFIRM      2
+// Frames without a finish signature before the next line
+#define FINISH_CLEAR        10
+// Frames the crossing flag is held after the crossing
+#define CROSSING_HOLD       3
+
+// Learned plain track level (0 = not learned yet)
+static uint32_t track_level = 0;
+
+// Debounce state
+static int finish_frames = 0;
+static int finish_clear = 0;
+static int crossing_frames = 0;
+static int crossing_hold = 0;
+
+/* Function: Markers_Reset
+ * -----------------------
+ *  Forgets the track level and any marking in progress.
+ *
+ *  Returns: void
+ */
+void Markers_Reset(void) {
+    track_level = 0;
+    finish_frames = 0;
+    finish_clear = 0;
+    crossing_frames = 0;
+    crossing_hold = 0;
+}
+
+/* Function: Markers_Update
+ * ------------------------
+ *  Checks one frame for the start/finish line and crossings.
+ *
+ *  line: camera line (calibrated)
+ *  deriv_sig: filtered derivative of the line
+ *  left_sub, right_sub: tracked edges (SUBPIXEL_SHIFT fixed
+ *      point)
+ *
+ *  Returns: MARKER_* flags
+ */
+int Markers_Update(uint16_t* line, int16_t* deriv_sig, int32_t left_sub, int32_t right_sub) {
+    int first = (left_sub >> SUBPIXEL_SHIFT) + EDGE_MARGIN;
+    int last = (right_sub >> SUBPIXEL_SHIFT) - EDGE_MARGIN;
+    int events = 0;
+
+    if (first < END_MARGIN) {
+        first = END_MARGIN;
+    }
+    if (last > PIXELS - 1 - END_MARGIN) {
+        last = PIXELS - 1 - END_MARGIN;
+    }
+
+    // Line levels: track interior and the whole line
+    uint32_t inside_sum = 0;
+    int inside = 0, inside_dark = 0, bright = 0;
+    uint32_t half = track_level / 2;
+    for (int i = END_MARGIN; i < PIXELS - END_MARGIN; i++) {
+        uint32_t v = line[i];
+        if (v > half) {
+            bright++;
+        }
+        if ((i >= first) && (i <= last)) {
+            inside_sum += v;
+            inside++;
+            if (v < half) {
+                inside_dark++;
+            }
+        }
+    }
+
+    if (inside == 0) {
+        return 0;
+    }
+
+    // First frame: nothing to compare against yet
+    if (track_level == 0) {
+        track_level = inside_sum / inside;
+        return 0;
+    }
+
+    // Alternating steps inside the track
+    int32_t step = track_level >> STEP_SHIFT;
+    int transitions = 0;
+    int sign = 0;
+    for (int i = first; i <= last; i++) {
+        int s = (deriv_sig[i] > step) ? 1 : ((deriv_sig[i] < -step) ? -1 : 0);
+        if ((s != 0) && (s != sign)) {
+            transitions++;
+            sign = s;
+        }
+    }
+
+    int finish = (transitions >= FINISH_TRANSITIONS) || \
+                 (inside_dark * DARK_DEN >= inside * DARK_NUM);
+    int crossing = (bright * BRIGHT_DEN >= (PIXELS - 2 * END_MARGIN) * BRIGHT_NUM) && !finish;
+
+    // Start/finish, once per line
+    if (finish) {
+        finish_clear = 0;
+        if (++finish_frames == MARKER_CONFIRM) {
+            events |= MARKER_FINISH;
+        }
+    } else if (finish_frames < MARKER_CONFIRM) {
+        // not confirmed, start over
+        finish_frames = 0;
+    } else if (++finish_clear >= FINISH_CLEAR) {
+        // line is behind the car
+        finish_frames = 0;
+    }
+
+    // Crossing, held a few frames after it ends
+    crossing_frames = crossing ? (crossing_frames + 1) : 0;
+    if (crossing_frames >= MARKER_CONFIRM) {
+        crossing_hold = CROSSING_HOLD;
+    }
+    if (crossing_hold > 0) {
+        events |= MARKER_CROSSING;
+        if (!crossing) {
+            crossing_hold--;
+        }
+    }
+
+    // Follow the plain track level (exposure changes)
+    if (!finish && !crossing) {
+        uint32_t level = inside_sum / inside;
+        track_level += ((int32_t) (level - track_level)) / 8;
+    }
+    return events;
+}
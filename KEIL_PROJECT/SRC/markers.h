@@ -0,0 +1,10 @@
+#ifndef  MARKERS_H_
+#define  MARKERS_H_
+
+// Markers_Update event flags
+#define MARKER_FINISH       0x01    // start/finish line passed (once per line)
+#define MARKER_CROSSING     0x02    // crossing in view (every frame it lasts)
+
+void Markers_Reset(void);
+int Markers_Update(uint16_t* line, int16_t* deriv_sig, int32_t left_sub, int32_t right_sub);
+#endif  /*  ifndef  MARKERS_H_  */
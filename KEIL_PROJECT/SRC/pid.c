@@ -0,0 +1,166 @@
+/*
+ * PID controller
+ *
+ * Position form PID in single precision float (the K64 FPU
+ * has no double precision, so double math is emulated):
+ *
+ *   out = clamp(kp e + I + D, out_min, out_max)
+ *   I  += ki dt e            (clamped to i_min..i_max)
+ *   D   = a D + (1 - a) kd (e - e_prev) / dt
+ *
+ * The derivative goes through a first order low-pass with
+ * cutoff d_cutoff_hz, so a noisy edge doesn't kick the
+ * output. The output saturation is fed back to the
+ * integrator: while the output is clamped, the integrator
+ * only moves back out of saturation (no windup at the
+ * servo end stops).
+ *
+ * File:    pid.c
+ * Authors: Seth Deane & Brian Powers
+ * Created: April 19 2019
+ */
+
+#include "MK64F12.h"
+#include "pid.h"
+
+#define PI_F                3.14159265f
+
+/* Function: Pid_Init
+ * ------------------
+ *  Sets up a controller, at rest.
+ *
+ *  pid: controller
+ *  kp, ki, kd: gains (ki per second, kd in seconds)
+ *  dt: sample time (seconds)
+ *  d_cutoff_hz: derivative low-pass cutoff, 0 = unfiltered
+ *  out_min, out_max: output limits (the integrator is
+ *      limited to the same range)
+ *
+ *  Returns: void
+ */
+void Pid_Init(Pid* pid, float kp, float ki, float kd, float dt, float d_cutoff_hz, \
+              float out_min, float out_max) {
+    pid->d_tau = 0.0f;
+    if (d_cutoff_hz > 0.0f) {
+        pid->d_tau = 1.0f / (2.0f * PI_F * d_cutoff_hz);
+    }
+    Pid_SetDt(pid, dt);
+    pid->out_min = out_min;
+    pid->out_max = out_max;
+    pid->i_min = out_min;
+    pid->i_max = out_max;
+    Pid_SetGains(pid, kp, ki, kd);
+    Pid_Reset(pid);
+}
+
+/* Function: Pid_SetGains
+ * ----------------------
+ *  Changes the gains. The integral is kept in output units,
+ *  so a new ki doesn't make the output jump.
+ *
+ *  pid: controller
+ *  kp, ki, kd: gains (ki per second, kd in seconds)
+ *
+ *  Returns: void
+ */
+void Pid_SetGains(Pid* pid, float kp, float ki, float kd) {
+    pid->kp = kp;
+    pid->ki = ki;
+    pid->kd = kd;
+}
+
+/* Function: Pid_SetDt
+ * --------------------
+ *  Changes the sample time, for a loop whose period varies.
+ *  The derivative low-pass keeps its cutoff.
+ *
+ *  pid: controller
+ *  dt: time since the last sample (seconds)
+ *
+ *  Returns: void
+ */
+void Pid_SetDt(Pid* pid, float dt) {
+    pid->dt = dt;
+    pid->d_alpha = pid->d_tau / (pid->d_tau + dt);
+}
+
+/* Function: Pid_Reset
+ * -------------------
+ *  Clears the integrator, derivative and error history.
+ *
+ *  pid: controller
+ *
+ *  Returns: void
+ */
+void Pid_Reset(Pid* pid) {
+    pid->integrator = 0.0f;
+    pid->derivative = 0.0f;
+    pid->prev_error = 0.0f;
+    pid->first = 1;
+    pid->out = 0.0f;
+    pid->saturated = 0;
+}
+
+/* Function: Pid_ResetDerivative
+ * -------------------------------
+ *  Clears the derivative and error history but keeps the
+ *  integrator, for a loop that skipped samples (its next
+ *  error difference would span the gap).
+ *
+ *  pid: controller
+ *
+ *  Returns: void
+ */
+void Pid_ResetDerivative(Pid* pid) {
+    pid->derivative = 0.0f;
+    pid->prev_error = 0.0f;
+    pid->first = 1;
+}
+
+/* Function: Pid_Update
+ * --------------------
+ *  Runs one sample.
+ *
+ *  pid: controller
+ *  error: setpoint - measurement
+ *
+ *  Returns: controller output (out_min..out_max)
+ */
+float Pid_Update(Pid* pid, float error) {
+    // Integrate unless the output is clamped and the error
+    //  pushes further into the clamp
+    float step = pid->ki * pid->dt * error;
+    if (!((pid->out >= pid->out_max) && (step > 0.0f)) && \
+        !((pid->out <= pid->out_min) && (step < 0.0f))) {
+        pid->integrator += step;
+        if (pid->integrator > pid->i_max) {
+            pid->integrator = pid->i_max;
+        } else if (pid->integrator < pid->i_min) {
+            pid->integrator = pid->i_min;
+        }
+    }
+
+    // Filtered derivative of the error (none on the first
+    //  sample, there is no previous error to difference)
+    if (pid->first) {
+        pid->prev_error = error;
+        pid->first = 0;
+    }
+    float d_raw = pid->kd * (error - pid->prev_error) / pid->dt;
+    pid->derivative = pid->d_alpha * pid->derivative + (1.0f - pid->d_alpha) * d_raw;
+    pid->prev_error = error;
+
+    float out = pid->kp * error + pid->integrator + pid->derivative;
+
+    pid->saturated = 1;
+    if (out > pid->out_max) {
+        out = pid->out_max;
+    } else if (out < pid->out_min) {
+        out = pid->out_min;
+    } else {
+        pid->saturated = 0;
+    }
+    pid->out = out;
+
+    return out;
+}
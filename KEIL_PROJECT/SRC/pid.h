@@ -0,0 +1,27 @@
+#ifndef  PID_H_
+#define  PID_H_
+
+// PID controller state (single precision, runs on the FPU)
+typedef struct {
+    float kp, ki, kd;           // gains (ki per second, kd in seconds)
+    float dt;                   // sample time (seconds)
+    float d_tau;                // derivative low-pass time constant (seconds)
+    float d_alpha;              // derivative low-pass, 0 = unfiltered
+    float out_min, out_max;     // output limits
+    float i_min, i_max;         // integrator limits
+    float integrator;           // integral term (output units)
+    float derivative;           // filtered derivative term (output units)
+    float prev_error;
+    int first;                  // 1 until the first sample
+    float out;                  // last output (after the clamp)
+    int saturated;              // 1 if the last output was clamped
+} Pid;
+
+void Pid_Init(Pid* pid, float kp, float ki, float kd, float dt, float d_cutoff_hz, \
+              float out_min, float out_max);
+void Pid_SetGains(Pid* pid, float kp, float ki, float kd);
+void Pid_SetDt(Pid* pid, float dt);
+void Pid_Reset(Pid* pid);
+void Pid_ResetDerivative(Pid* pid);
+float Pid_Update(Pid* pid, float error);
+#endif  /*  ifndef  PID_H_  */
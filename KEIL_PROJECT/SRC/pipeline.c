@@ -0,0 +1,451 @@
+/*
+ * Runtime-configurable filter chain
+ *
+ * The chain that turns a camera line into the derivative
+ * signal is an ordered list of stages held in a static
+ * arena (no heap). Stages can be swapped at runtime with
+ * text commands on UART0, and each stage records the
+ * cycles its last run took.
+ *
+ * Commands (one per line):
+ *   show               list the stages and their cycles
+ *   clear              remove all stages
+ *   default            median 3, {1,2,4,2,1}/10, {1,0,-1}
+ *   fused              add the single pass default chain
+ *   median N           add an N wide median (odd, <= 31)
+ *   fir C T0 T1 ...    add a centred FIR, divided by C
+ *   deriv              add the {1,0,-1} derivative
+ *   thresh T           add a |x| < T -> 0 threshold
+ *   sched              print the control loop timing
+ *                      counters (scheduler.c)
+ *
+ * The default chain is the single fused stage, which runs
+ * straight on the camera buffer. Other chains work in 32
+ * bit ping-pong buffers, edges replicate the end samples.
+ *
+ * File:    pipeline.c
+ * Authors: Seth Deane & Brian Powers
+ * Created: April 12 2019
+ */
+
+#include "MK64F12.h"
+#include "common.h"
+#include "filters.h"
+#include "pipeline.h"
+#include "camera.h"
+#include "scheduler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Number of pixels in a line
+#define PIXELS              128
+
+// Longest UART command
+#define CMD_LENGTH          64
+
+// Stage arena
+static Stage stages[PIPELINE_MAX_STAGES];
+static int stage_count = 0;
+
+// Ping-pong working buffers for multi-stage chains
+static int32_t work[2][PIXELS];
+static uint16_t fused_in[PIXELS];
+static int16_t fused_out[PIXELS];
+static uint16_t median_out[PIXELS];
+
+// UART command being received
+static char cmd[CMD_LENGTH];
+static int cmd_length = 0;
+static char pipe_str[100];
+
+/* Function: stage_add
+ * -------------------
+ *  Takes the next free stage from the arena.
+ *
+ *  Returns: the stage, or 0 if the arena is full
+ */
+static Stage* stage_add(int type) {
+    if (stage_count >= PIPELINE_MAX_STAGES) {
+        return 0;
+    }
+    Stage* st = &stages[stage_count++];
+    memset(st, 0, sizeof(*st));
+    st->type = type;
+    return st;
+}
+
+/* Function: clamp_index
+ * ---------------------
+ *  Keeps an index inside the line (replicates the ends).
+ */
+static inline int clamp_index(int i) {
+    if (i < 0) {
+        return 0;
+    }
+    if (i >= PIXELS) {
+        return PIXELS - 1;
+    }
+    return i;
+}
+
+/* Function: run_fused
+ * -------------------
+ *  filter_fused_simd on 32 bit buffers (input clamped to 16 bit).
+ */
+static void run_fused(Stage* st, int32_t* x, int32_t* y) {
+    for (int i = 0; i < PIXELS; i++) {
+        int32_t v = x[i];
+        fused_in[i] = (v < 0) ? 0 : ((v > 0xFFFF) ? 0xFFFF : v);
+    }
+    filter_fused_simd(fused_in, fused_out, PIXELS);
+    for (int i = 0; i < PIXELS; i++) {
+        y[i] = fused_out[i];
+    }
+}
+
+/* Function: run_median
+ * --------------------
+ *  Median of width st->width. Lines inside 0..65535 (camera
+ *  data) go through median_filter_wide. Signed lines (after
+ *  deriv or a FIR with negative taps) keep their sign and
+ *  use an insertion sort of the window.
+ */
+static void run_median(Stage* st, int32_t* x, int32_t* y) {
+    int half = st->width / 2;
+    int32_t window[MEDIAN_MAX_WIDTH];
+    int in_range = 1;
+
+    for (int i = 0; i < PIXELS; i++) {
+        if ((x[i] < 0) || (x[i] > 0xFFFF)) {
+            in_range = 0;
+            break;
+        }
+    }
+
+    if (in_range) {
+        for (int i = 0; i < PIXELS; i++) {
+            fused_in[i] = x[i];
+        }
+        median_filter_wide(fused_in, median_out, PIXELS, st->width);
+        for (int i = 0; i < PIXELS; i++) {
+            y[i] = median_out[i];
+        }
+        return;
+    }
+
+    for (int i = 0; i < PIXELS; i++) {
+        for (int j = 0; j < st->width; j++) {
+            int32_t v = x[clamp_index(i + j - half)];
+            int k = j;
+            while ((k > 0) && (window[k-1] > v)) {
+                window[k] = window[k-1];
+                k--;
+            }
+            window[k] = v;
+        }
+        y[i] = window[half];
+    }
+}
+
+/* Function: run_fir
+ * -----------------
+ *  Centred FIR: y[i] = sum(h[j] * x[i + j - n/2]) / correction
+ */
+static void run_fir(Stage* st, int32_t* x, int32_t* y) {
+    int half = st->width / 2;
+
+    for (int i = 0; i < PIXELS; i++) {
+        int32_t sum = 0;
+        for (int j = 0; j < st->width; j++) {
+            sum += st->taps[j] * x[clamp_index(i + j - half)];
+        }
+        y[i] = sum / st->correction;
+    }
+}
+
+/* Function: run_deriv
+ * -------------------
+ *  {1,0,-1} derivative with the der_convolve alignment.
+ */
+static void run_deriv(Stage* st, int32_t* x, int32_t* y) {
+    for (int i = 0; i < PIXELS; i++) {
+        y[i] = x[i] - x[clamp_index(i - 2)];
+    }
+}
+
+/* Function: run_threshold
+ * -----------------------
+ *  Zeroes values with |x| below st->threshold.
+ */
+static void run_threshold(Stage* st, int32_t* x, int32_t* y) {
+    for (int i = 0; i < PIXELS; i++) {
+        y[i] = (abs(x[i]) < st->threshold) ? 0 : x[i];
+    }
+}
+
+// Stage implementations and names, indexed by type
+typedef void (*StageFunc)(Stage* st, int32_t* x, int32_t* y);
+static const StageFunc stage_funcs[] = {
+    run_fused, run_median, run_fir, run_deriv, run_threshold
+};
+static char* const stage_names[] = {
+    "fused", "median", "fir", "deriv", "thresh"
+};
+
+/* Function: Pipeline_Clear
+ * ------------------------
+ *  Removes all stages. An empty chain outputs 0.
+ *
+ *  Returns: void
+ */
+void Pipeline_Clear(void) {
+    stage_count = 0;
+}
+
+/* Function: Pipeline_Default
+ * --------------------------
+ *  Sets the chain to the tuned default (the single pass
+ *  median 3, {1,2,4,2,1}/10, {1,0,-1} stage).
+ *
+ *  Returns: void
+ */
+void Pipeline_Default(void) {
+    Pipeline_Clear();
+    Pipeline_AddFused();
+}
+
+/* Function: Pipeline_AddFused
+ * ---------------------------
+ *  Appends the single pass default chain.
+ *
+ *  Returns: 1 if added, 0 if the arena is full
+ */
+int Pipeline_AddFused(void) {
+    return stage_add(STAGE_FUSED) != 0;
+}
+
+/* Function: Pipeline_AddMedian
+ * ----------------------------
+ *  Appends a median filter.
+ *
+ *  width: window width (odd, 1..MEDIAN_MAX_WIDTH)
+ *
+ *  Returns: 1 if added, 0 if invalid or the arena is full
+ */
+int Pipeline_AddMedian(int width) {
+    if ((width < 1) || (width > MEDIAN_MAX_WIDTH) || ((width & 1) == 0)) {
+        return 0;
+    }
+    Stage* st = stage_add(STAGE_MEDIAN);
+    if (st == 0) {
+        return 0;
+    }
+    st->width = width;
+    return 1;
+}
+
+/* Function: Pipeline_AddFir
+ * -------------------------
+ *  Appends a centred FIR filter.
+ *
+ *  taps: filter array
+ *  n: number of taps (1..PIPELINE_MAX_TAPS)
+ *  correction: divisor, e.g. sum of taps (non-zero)
+ *
+ *  Returns: 1 if added, 0 if invalid or the arena is full
+ */
+int Pipeline_AddFir(int16_t* taps, int n, int correction) {
+    if ((n < 1) || (n > PIPELINE_MAX_TAPS) || (correction == 0)) {
+        return 0;
+    }
+    Stage* st = stage_add(STAGE_FIR);
+    if (st == 0) {
+        return 0;
+    }
+    st->width = n;
+    st->correction = correction;
+    for (int j = 0; j < n; j++) {
+        st->taps[j] = taps[j];
+    }
+    return 1;
+}
+
+/* Function: Pipeline_AddDerivative
+ * --------------------------------
+ *  Appends the {1,0,-1} derivative.
+ *
+ *  Returns: 1 if added, 0 if the arena is full
+ */
+int Pipeline_AddDerivative(void) {
+    return stage_add(STAGE_DERIV) != 0;
+}
+
+/* Function: Pipeline_AddThreshold
+ * -------------------------------
+ *  Appends a threshold that zeroes small values.
+ *
+ *  threshold: values with |x| below this become 0
+ *
+ *  Returns: 1 if added, 0 if the arena is full
+ */
+int Pipeline_AddThreshold(int threshold) {
+    Stage* st = stage_add(STAGE_THRESHOLD);
+    if (st == 0) {
+        return 0;
+    }
+    st->threshold = threshold;
+    return 1;
+}
+
+/* Function: Pipeline_Run
+ * ----------------------
+ *  Runs the chain on a camera line and records each
+ *  stage's cycle cost.
+ *
+ *  camera_sig: camera line
+ *  deriv_sig: output of the last stage
+ *
+ *  Returns: void
+ */
+void Pipeline_Run(uint16_t* camera_sig, int16_t* deriv_sig) {
+    uint32_t start;
+
+    // The default chain needs no conversions
+    if ((stage_count == 1) && (stages[0].type == STAGE_FUSED)) {
+        start = cycle_count();
+        filter_fused_simd(camera_sig, deriv_sig, PIXELS);
+        stages[0].cycles = cycle_count() - start;
+        return;
+    }
+
+    int32_t* in = work[0];
+    int32_t* out = work[1];
+
+    for (int i = 0; i < PIXELS; i++) {
+        in[i] = (stage_count > 0) ? camera_sig[i] : 0;
+    }
+
+    for (int s = 0; s < stage_count; s++) {
+        start = cycle_count();
+        stage_funcs[stages[s].type](&stages[s], in, out);
+        stages[s].cycles = cycle_count() - start;
+
+        int32_t* t = in;
+        in = out;
+        out = t;
+    }
+
+    for (int i = 0; i < PIXELS; i++) {
+        deriv_sig[i] = in[i];
+    }
+}
+
+/* Function: Pipeline_Print
+ * ------------------------
+ *  Lists the stages and their last cycle cost on UART0.
+ *
+ *  Returns: void
+ */
+void Pipeline_Print(void) {
+    put("\n\rpipeline:\n\r");
+    for (int s = 0; s < stage_count; s++) {
+        Stage* st = &stages[s];
+        sprintf(pipe_str, "%d %s", s, stage_names[st->type]);
+        put(pipe_str);
+        if (st->type == STAGE_MEDIAN) {
+            sprintf(pipe_str, " %d", st->width);
+            put(pipe_str);
+        } else if (st->type == STAGE_FIR) {
+            sprintf(pipe_str, " /%d", st->correction);
+            put(pipe_str);
+            for (int j = 0; j < st->width; j++) {
+                sprintf(pipe_str, " %d", st->taps[j]);
+                put(pipe_str);
+            }
+        } else if (st->type == STAGE_THRESHOLD) {
+            sprintf(pipe_str, " %d", st->threshold);
+            put(pipe_str);
+        }
+        sprintf(pipe_str, ": %lu cycles\n\r", (unsigned long) st->cycles);
+        put(pipe_str);
+    }
+}
+
+/* Function: pipeline_command
+ * --------------------------
+ *  Executes one command line.
+ *
+ *  Returns: 1 if the command was understood, 0 otherwise
+ */
+static int pipeline_command(char* line) {
+    char* arg;
+    char* word = strtok(line, " \t");
+    int ok = 1;
+
+    if (word == 0) {
+        return 1;
+    }
+    arg = strtok(0, "");
+
+    if (strcmp(word, "show") == 0) {
+        Pipeline_Print();
+    } else if (strcmp(word, "sched") == 0) {
+        Scheduler_Print();
+    } else if (strcmp(word, "clear") == 0) {
+        Pipeline_Clear();
+    } else if (strcmp(word, "default") == 0) {
+        Pipeline_Default();
+    } else if (strcmp(word, "fused") == 0) {
+        ok = Pipeline_AddFused();
+    } else if (strcmp(word, "deriv") == 0) {
+        ok = Pipeline_AddDerivative();
+    } else if ((strcmp(word, "median") == 0) && (arg != 0)) {
+        ok = Pipeline_AddMedian(atoi(arg));
+    } else if ((strcmp(word, "thresh") == 0) && (arg != 0)) {
+        ok = Pipeline_AddThreshold(atoi(arg));
+    } else if ((strcmp(word, "fir") == 0) && (arg != 0)) {
+        int16_t taps[PIPELINE_MAX_TAPS];
+        int n = 0;
+        char* end;
+        long correction = strtol(arg, &end, 10);
+        while (n < PIPELINE_MAX_TAPS) {
+            char* next;
+            long tap = strtol(end, &next, 10);
+            if (next == end) {
+                break;
+            }
+            taps[n++] = tap;
+            end = next;
+        }
+        ok = Pipeline_AddFir(taps, n, correction);
+    } else {
+        ok = 0;
+    }
+
+    return ok;
+}
+
+/* Function: Pipeline_Poll
+ * -----------------------
+ *  Reads any waiting UART0 characters without blocking and
+ *  executes complete command lines. Call between frames so
+ *  the chain never changes while it runs.
+ *
+ *  Returns: void
+ */
+void Pipeline_Poll(void) {
+    while (charReady()) {
+        char ch = getChar();
+
+        if ((ch == '\r') || (ch == '\n')) {
+            cmd[cmd_length] = '\0';
+            if (cmd_length > 0) {
+                put(pipeline_command(cmd) ? "ok\n\r" : "error\n\r");
+            }
+            cmd_length = 0;
+        } else if (cmd_length < CMD_LENGTH - 1) {
+            cmd[cmd_length++] = ch;
+        }
+    }
+}
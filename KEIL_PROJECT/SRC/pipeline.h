@@ -0,0 +1,35 @@
+#ifndef  PIPELINE_H_
+#define  PIPELINE_H_
+
+// Limits of the static stage arena
+#define PIPELINE_MAX_STAGES     8
+#define PIPELINE_MAX_TAPS       9
+
+// Stage types
+#define STAGE_FUSED             0   // median 3, {1,2,4,2,1}/10, {1,0,-1} in one pass
+#define STAGE_MEDIAN            1   // median of width N (odd)
+#define STAGE_FIR               2   // centred FIR kernel / correction
+#define STAGE_DERIV             3   // {1,0,-1} derivative, y[i] = x[i] - x[i-2]
+#define STAGE_THRESHOLD         4   // zero values with |x| below a threshold
+
+// One stage of the filter chain
+typedef struct {
+    int type;
+    int width;                      // median width / FIR taps
+    int16_t taps[PIPELINE_MAX_TAPS];
+    int correction;                 // FIR divisor
+    int threshold;
+    uint32_t cycles;                // cost of the last run
+} Stage;
+
+void Pipeline_Clear(void);
+void Pipeline_Default(void);
+int Pipeline_AddFused(void);
+int Pipeline_AddMedian(int width);
+int Pipeline_AddFir(int16_t* taps, int n, int correction);
+int Pipeline_AddDerivative(void);
+int Pipeline_AddThreshold(int threshold);
+void Pipeline_Run(uint16_t* camera_sig, int16_t* deriv_sig);
+void Pipeline_Print(void);
+void Pipeline_Poll(void);
+#endif  /*  ifndef  PIPELINE_H_  */
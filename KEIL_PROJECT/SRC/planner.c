@@ -0,0 +1,235 @@
+/*
+ * Curvature-aware speed planner
+ *
+ * Estimates how hard the track ahead turns (0 = straight,
+ * 1 = tightest) from
+ *   - the near camera: the average track center offset
+ *     over the last HISTORY frames, and how fast it moves
+ *     (least squares slope), which rises as a curve starts
+ *   - the far camera, if fitted (CAMERA_COUNT 2): the
+ *     offset of the track center further ahead, seen before
+ *     the car turns in. A far line only counts as track if
+ *     its bright pixels form one segment of track-like width
+ *     (noise or a missing camera gives scattered pixels),
+ *     and the far camera only brakes the car after
+ *     FAR_CONFIRM such lines in a row with a steady center.
+ * and maps it to a target motor duty between the straight
+ * and the corner speed. The target then follows with an
+ * acceleration and a (faster) braking limit per second,
+ * applied over the measured loop period, so the car brakes as a corner shows up in the far
+ * camera and gets back on the power gently out of it.
+ *
+ * On laps raced from the lap map (lapmap.c) the map's planned
+ * curvature is used in place of the camera estimate.
+ *
+ * File:    planner.c
+ * Authors: Seth Deane & Brian Powers
+ * Created: April 22 2019
+ */
+
+#include "MK64F12.h"
+#include "camera.h"
+#include "planner.h"
+
+// Number of pixels in a line
+#define PIXELS              128
+#define CENTER              64.0f
+
+// Near camera center history (frames)
+#define HISTORY             8
+
+// Offsets and slope that count as the tightest curve
+#define NEAR_FULL           24.0f       // pixels
+#define SLOPE_FULL          2.0f        // pixels per frame
+#define FAR_FULL            20.0f       // pixels
+
+// Far line contrast below this has no track in it
+#define FAR_MIN_CONTRAST    2048
+// Width of the bright segment (pixels), the share of the
+//  bright pixels it must hold (of 16), the good lines needed
+//  and the largest center jump between them (pixels)
+#define FAR_MIN_WIDTH       8
+#define FAR_MAX_WIDTH       120
+#define FAR_MIN_SHARE       12
+#define FAR_CONFIRM         5
+#define FAR_MAX_JUMP        8.0f
+
+// Duty change limits (percent per second)
+#define ACCEL_LIMIT         40.0f
+#define BRAKE_LIMIT         200.0f
+
+static float history[HISTORY];
+static int history_count = 0;
+static int history_next = 0;
+static float curvature = 0.0f;
+static float speed = 0.0f;
+static int far_good = 0;
+static float far_last = -1.0f;
+
+/* Function: Planner_Reset
+ * -----------------------
+ *  Forgets the history and starts the ramp at a speed.
+ *
+ *  speed_start: current motor duty (percent)
+ *
+ *  Returns: void
+ */
+void Planner_Reset(float speed_start) {
+    history_count = 0;
+    history_next = 0;
+    curvature = 0.0f;
+    speed = speed_start;
+    far_good = 0;
+    far_last = -1.0f;
+}
+
+/* Function: far_segment
+ * ---------------------
+ *  Finds the track in a far line: the longest run of pixels
+ *  above the middle of the line's range.
+ *
+ *  Returns: run center (pixels), or -1 if the line doesn't
+ *      look like track
+ */
+static float far_segment(uint16_t* line) {
+    uint16_t lo = 0xFFFF, hi = 0;
+
+    for (int i = 0; i < PIXELS; i++) {
+        if (line[i] < lo) {
+            lo = line[i];
+        }
+        if (line[i] > hi) {
+            hi = line[i];
+        }
+    }
+    if (hi - lo < FAR_MIN_CONTRAST) {
+        return -1.0f;
+    }
+
+    uint16_t level = lo + (hi - lo) / 2;
+    int bright = 0;
+    int run = 0;
+    int best_run = 0;
+    int best_end = 0;
+    for (int i = 0; i < PIXELS; i++) {
+        if (line[i] > level) {
+            bright++;
+            run++;
+            if (run > best_run) {
+                best_run = run;
+                best_end = i;
+            }
+        } else {
+            run = 0;
+        }
+    }
+    if ((best_run < FAR_MIN_WIDTH) || (best_run > FAR_MAX_WIDTH) || \
+        (best_run * 16 < bright * FAR_MIN_SHARE)) {
+        return -1.0f;
+    }
+    return (float) best_end - 0.5f * (float) (best_run - 1);
+}
+
+/* Function: Planner_FarCenter
+ * ---------------------------
+ *  Track center in a far camera line, once the far camera
+ *  has shown track for FAR_CONFIRM lines in a row.
+ *
+ *  line: far camera line (calibrated)
+ *
+ *  Returns: center (pixels), or -1 if not (yet) trusted
+ */
+float Planner_FarCenter(uint16_t* line) {
+    float center = far_segment(line);
+
+    if ((center < 0.0f) || ((far_last >= 0.0f) && \
+        ((center - far_last > FAR_MAX_JUMP) || (far_last - center > FAR_MAX_JUMP)))) {
+        far_good = 0;
+    } else if (far_good < FAR_CONFIRM) {
+        far_good++;
+    }
+    far_last = center;
+
+    return (far_good >= FAR_CONFIRM) ? center : -1.0f;
+}
+
+/* Function: Planner_Update
+ * ------------------------
+ *  Adds a frame and steps the target speed.
+ *
+ *  middle: near track center (pixels)
+ *  far_middle: far track center (pixels), < 0 if unknown
+ *  preview: planned curvature from the lap map (0..1), used
+ *      instead of the estimate, < 0 if there is no map
+ *  speed_max: duty on a straight (percent)
+ *  speed_min: duty in the tightest curve (percent)
+ *  dt: time since the last update (seconds)
+ *
+ *  Returns: target motor duty (percent)
+ */
+float Planner_Update(float middle, float far_middle, float preview, float speed_max, float speed_min, \
+                     float dt) {
+    history[history_next] = middle - CENTER;
+    history_next = (history_next + 1) % HISTORY;
+    if (history_count < HISTORY) {
+        history_count++;
+    }
+
+    // Mean offset and least squares slope, oldest sample at x = 0
+    float n = (float) history_count;
+    float sx = 0.0f, sy = 0.0f, sxx = 0.0f, sxy = 0.0f;
+    for (int k = 0; k < history_count; k++) {
+        float x = (float) k;
+        float y = history[(history_next - history_count + k + HISTORY) % HISTORY];
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        sxy += x * y;
+    }
+    float mean = sy / n;
+    float slope = 0.0f;
+    if (history_count > 1) {
+        slope = (n * sxy - sx * sy) / (n * sxx - sx * sx);
+    }
+
+    float c_near = ((mean < 0.0f) ? -mean : mean) / NEAR_FULL;
+    float c_slope = ((slope < 0.0f) ? -slope : slope) / SLOPE_FULL;
+    float c = (c_near > c_slope) ? c_near : c_slope;
+    if (far_middle >= 0.0f) {
+        float far = far_middle - CENTER;
+        float c_far = ((far < 0.0f) ? -far : far) / FAR_FULL;
+        if (c_far > c) {
+            c = c_far;
+        }
+    }
+    if (c > 1.0f) {
+        c = 1.0f;
+    }
+    curvature = c;
+
+    // The map knows what is coming
+    if (preview >= 0.0f) {
+        c = preview;
+    }
+
+    // Target for the curvature, then the rate limits
+    float target = speed_max - (speed_max - speed_min) * c;
+    float up = ACCEL_LIMIT * dt;
+    float down = BRAKE_LIMIT * dt;
+    if (target > speed + up) {
+        speed += up;
+    } else if (target < speed - down) {
+        speed -= down;
+    } else {
+        speed = target;
+    }
+    return speed;
+}
+
+/* Function: Planner_Curvature
+ * ---------------------------
+ *  Returns: the last curvature estimate (0 straight .. 1)
+ */
+float Planner_Curvature(void) {
+    return curvature;
+}
@@ -0,0 +1,8 @@
+#ifndef  PLANNER_H_
+#define  PLANNER_H_
+void Planner_Reset(float speed);
+float Planner_FarCenter(uint16_t* line);
+float Planner_Update(float middle, float far_middle, float preview, float speed_max, float speed_min, \
+                     float dt);
+float Planner_Curvature(void);
+#endif  /*  ifndef  PLANNER_H_  */
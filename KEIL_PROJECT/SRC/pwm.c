@@ -86,10 +86,10 @@ void SetMotorDutyCycleR(unsigned int DutyCycle, unsigned int Frequency, int dir)
  * Returns:
  *  void
  */
-void SetServoDutyCycle(double DutyCycle)
+void SetServoDutyCycle(float DutyCycle)
 {
     // Calculate the new cutoff value
-    double mod = (double) (((CLOCK/128/SERVO_FREQUENCY) * DutyCycle) / 100);
+    float mod = (((CLOCK/128/SERVO_FREQUENCY) * DutyCycle) / 100.0f);
 
     // Set outputs
 	FTM3_C4V = mod;
@@ -3,7 +3,7 @@
 
 void SetMotorDutyCycleL(unsigned int DutyCycle, unsigned int Frequency, int dir);
 void SetMotorDutyCycleR(unsigned int DutyCycle, unsigned int Frequency, int dir);
-void SetServoDutyCycle(double DutyCycle);
+void SetServoDutyCycle(float DutyCycle);
 void init_PWM(void);
 void PWM_ISR(void);
 
@@ -0,0 +1,139 @@
+/*
+ * Lost-track safe mode
+ *
+ * Each frame's detection confidence (0..SAFETY_CONF_ONE) is
+ * smoothed and drives a three state machine:
+ *
+ *   NORMAL   -> DEGRADED  smoothed confidence < CONF_DEGRADED
+ *   DEGRADED -> LOST      smoothed confidence < CONF_LOST, or
+ *                         LOST_FRAMES frames in DEGRADED
+ *                         without a good detection
+ *   DEGRADED,
+ *   LOST     -> NORMAL    RECOVER_FRAMES good detections in
+ *                         a row (confidence >= CONF_RECOVER)
+ *
+ * The motor duty is scaled by a factor that ramps towards
+ * the state's limit: fast down, slowly back up. The caller
+ * holds the last good steering outside NORMAL.
+ *
+ * File:    safety.c
+ * Authors: Seth Deane & Brian Powers
+ * Created: April 17 2019
+ */
+
+#include "MK64F12.h"
+#include "safety.h"
+
+// Confidence levels (SAFETY_CONF_ONE scale). Edges_Find
+//  rates a pair where expected 256 and a single edge where
+//  expected 192, both good enough to recover; either one a
+//  sigma off (128 and 96) still keeps NORMAL.
+#define CONF_DEGRADED       96
+#define CONF_LOST           32
+#define CONF_RECOVER        160
+
+// Frames without a good detection before DEGRADED gives up
+#define LOST_FRAMES         10
+// Good detections in a row needed to go back to NORMAL
+#define RECOVER_FRAMES      5
+
+// Motor scale (256 = 1.0) per state, and the ramp steps
+#define SCALE_ONE           256
+#define SCALE_DEGRADED      128
+#define SCALE_LOST          0
+#define RAMP_DOWN           32
+#define RAMP_UP             8
+
+static int state = SAFETY_NORMAL;
+static int smoothed = SAFETY_CONF_ONE;
+static int bad_frames = 0;
+static int good_frames = 0;
+static int scale = SCALE_ONE;
+
+/* Function: Safety_Reset
+ * ----------------------
+ *  Back to NORMAL at full speed (start of a run).
+ *
+ *  Returns: void
+ */
+void Safety_Reset(void) {
+    state = SAFETY_NORMAL;
+    smoothed = SAFETY_CONF_ONE;
+    bad_frames = 0;
+    good_frames = 0;
+    scale = SCALE_ONE;
+}
+
+/* Function: Safety_Update
+ * -----------------------
+ *  Feeds one frame's detection confidence, steps the state
+ *  machine and the motor ramp.
+ *
+ *  confidence: detection confidence (0..SAFETY_CONF_ONE)
+ *
+ *  Returns: the new state
+ */
+int Safety_Update(int confidence) {
+    int limit;
+
+    // Smooth over ~4 frames
+    smoothed += (confidence - smoothed) / 4;
+
+    if (confidence >= CONF_RECOVER) {
+        good_frames++;
+        bad_frames = 0;
+    } else {
+        good_frames = 0;
+        bad_frames++;
+    }
+
+    switch (state) {
+        case SAFETY_NORMAL:
+            if (smoothed < CONF_DEGRADED) {
+                state = SAFETY_DEGRADED;
+            }
+            break;
+        case SAFETY_DEGRADED:
+            if ((smoothed < CONF_LOST) || (bad_frames >= LOST_FRAMES)) {
+                state = SAFETY_LOST;
+            } else if (good_frames >= RECOVER_FRAMES) {
+                state = SAFETY_NORMAL;
+            }
+            break;
+        default:
+            if (good_frames >= RECOVER_FRAMES) {
+                state = SAFETY_NORMAL;
+            }
+            break;
+    }
+
+    limit = (state == SAFETY_NORMAL) ? SCALE_ONE : \
+            ((state == SAFETY_DEGRADED) ? SCALE_DEGRADED : SCALE_LOST);
+    if (scale > limit) {
+        scale = (scale - RAMP_DOWN > limit) ? (scale - RAMP_DOWN) : limit;
+    } else if (scale < limit) {
+        scale = (scale + RAMP_UP < limit) ? (scale + RAMP_UP) : limit;
+    }
+
+    return state;
+}
+
+/* Function: Safety_State
+ * ----------------------
+ *  Returns: the current state (SAFETY_*)
+ */
+int Safety_State(void) {
+    return state;
+}
+
+/* Function: Safety_ScaleDuty
+ * --------------------------
+ *  Applies the motor ramp to a duty cycle.
+ *
+ *  duty: duty cycle wanted (percent)
+ *
+ *  Returns: duty cycle to drive (percent)
+ */
+int Safety_ScaleDuty(int duty) {
+    return (duty * scale) / SCALE_ONE;
+}
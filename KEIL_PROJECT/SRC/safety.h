@@ -0,0 +1,16 @@
+#ifndef  SAFETY_H_
+#define  SAFETY_H_
+
+// Detection states
+#define SAFETY_NORMAL       0   // track seen, full speed
+#define SAFETY_DEGRADED     1   // poor detections, slow down
+#define SAFETY_LOST         2   // no track, stop
+
+// Confidence of a perfect detection (same scale as EDGE_CONF_ONE)
+#define SAFETY_CONF_ONE     256
+
+void Safety_Reset(void);
+int Safety_Update(int confidence);
+int Safety_State(void);
+int Safety_ScaleDuty(int duty);
+#endif  /*  ifndef  SAFETY_H_  */
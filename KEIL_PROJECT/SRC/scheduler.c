@@ -0,0 +1,327 @@
+/*
+ * Fixed-rate control loop scheduler
+ *
+ * PIT1 ticks at SCHEDULER_PERIOD. Scheduler_Wait() sleeps
+ * until the next tick, drops any frame completed before it,
+ * then sleeps until the camera publishes the next frame, so
+ * perception and control run on a frame that is only as old
+ * as the wake-up latency, whatever integration time the
+ * auto-exposure picks. PIT0 and PIT1 are not phase aligned
+ * (their periods differ as the exposure changes), so the
+ * iteration start moves by up to one frame period after the
+ * tick instead.
+ *
+ * The exposure is not limited to the control period. When a
+ * frame (integration plus readout) takes longer than a
+ * period, the wait for it runs past the following ticks and
+ * the loop runs once per frame instead (counted as a
+ * stretched period). Scheduler_Dt() gives the measured time
+ * between iteration starts for the controllers to integrate
+ * and rate limit over. PIT1 is the watchdog: if no frame
+ * arrives within the expected frame time plus a period the
+ * iteration runs on the frame it has (counted as a timeout).
+ *
+ * An iteration that is still running when the next tick
+ * fires is an overrun: the ticks it covered are counted as
+ * missed and the loop continues from the latest tick (no
+ * catch-up burst). Tick interval jitter, tick to iteration
+ * latency and the longest iteration are kept as well.
+ *
+ * File:    scheduler.c
+ * Authors: Seth Deane & Brian Powers
+ * Created: April 18 2019
+ */
+
+#include "MK64F12.h"
+#include "camera.h"
+#include "common.h"
+#include "scheduler.h"
+#include <stdio.h>
+
+// Default System clock value (PIT and cycle counter clock)
+#define DEFAULT_SYSTEM_CLOCK 20485760u
+
+// Control period in PIT1 ticks
+#define PERIOD_TICKS        ((uint32_t)(DEFAULT_SYSTEM_CLOCK * SCHEDULER_PERIOD))
+
+// Line readout (129 camera clocks of two ~10us FTM2
+//  periods, camera.c)
+#define READOUT_TICKS       (129u * 2u * (DEFAULT_SYSTEM_CLOCK / 100000u))
+
+// Tick count and the cycle_count() of the last tick (ISR)
+static volatile uint32_t tick_count = 0;
+static volatile uint32_t tick_stamp = 0;
+
+// Last tick handled, and when its iteration started
+static uint32_t last_tick = 0;
+static uint32_t run_start = 0;
+
+// Time between the last two iteration starts (seconds)
+static float run_dt = SCHEDULER_PERIOD;
+
+static SchedulerStats stats;
+
+// Char array for the report
+static char sched_str[100];
+
+/* Scheduler_Init
+* Description:
+*   Starts PIT1 at the control period. Call after init_PIT
+*   (which enables the PIT clock).
+*
+* Parameters:
+*   void
+*
+* Returns:
+*   void
+*/
+void Scheduler_Init(void) {
+
+    PIT_LDVAL1 = PERIOD_TICKS - 1;
+
+    // Enable timer interrupts
+    PIT_TCTRL1 |= PIT_TCTRL_TIE_MASK;
+
+    // Clear interrupt flag
+    PIT_TFLG1 |= PIT_TFLG_TIF_MASK;
+
+    // Enable the timer
+    PIT_TCTRL1 |= PIT_TCTRL_TEN_MASK;
+
+    // Enable PIT interrupt in the interrupt controller
+    NVIC_EnableIRQ(PIT1_IRQn);
+
+    Scheduler_ClearStats();
+
+} // Scheduler_Init
+
+/* PIT1_IRQHandler
+* Description:
+*   Control tick. Counts it and measures the interval
+*   jitter against the nominal period.
+*
+* Parameters:
+*   void
+*
+* Returns:
+*   void
+*/
+void PIT1_IRQHandler(void) {
+
+    uint32_t now = cycle_count();
+
+    // Clear interrupt
+    PIT_TFLG1 |= PIT_TFLG_TIF_MASK;
+
+    if (tick_count != 0) {
+        int32_t jitter = (int32_t)(now - tick_stamp - PERIOD_TICKS);
+        if (jitter < 0) {
+            jitter = -jitter;
+        }
+        if ((uint32_t) jitter > stats.jitter_max) {
+            stats.jitter_max = jitter;
+        }
+    }
+
+    tick_stamp = now;
+    tick_count++;
+
+} // PIT1_IRQHandler
+
+/* Scheduler_Wait
+* Description:
+*   Ends the current iteration: sleeps until the next
+*   control tick, then until the next camera frame (or the
+*   watchdog tick, if the camera stalls).
+*
+* Parameters:
+*   frame - filled like Camera_GetFrame
+*
+* Returns:
+*   int - 1 if the frame is new, 0 if no frame completed
+*         since the last iteration (stale)
+*/
+int Scheduler_Wait(CameraFrame* frame) {
+
+    uint32_t now = cycle_count();
+    uint32_t ticks, stamp;
+
+    // Time spent in the iteration that just ended
+    if (stats.runs != 0) {
+        if (now - run_start > stats.busy_max) {
+            stats.busy_max = now - run_start;
+        }
+    }
+
+    // Sleep until a tick we haven't handled (the check runs
+    //  with interrupts masked, so a tick can't slip in
+    //  between it and the WFI)
+    __disable_irq();
+    while (tick_count == last_tick) {
+        __WFI();
+        __enable_irq();
+        __disable_irq();
+    }
+    ticks = tick_count;
+    stamp = tick_stamp;
+    __enable_irq();
+
+    // More than one tick since the last iteration: overrun
+    if (stats.runs != 0) {
+        if (ticks - last_tick > 1) {
+            stats.overruns++;
+            stats.missed += ticks - last_tick - 1;
+        }
+    }
+
+    // Ticks the next frame may take: its integration plus
+    //  readout, and the period it starts in
+    uint32_t watchdog = (Camera_GetIntegration() + READOUT_TICKS) / PERIOD_TICKS + 1;
+
+    // Take any frame completed before the tick (only kept if
+    //  the next one doesn't come), then sleep until the next
+    //  frame is published or the watchdog tick fires
+    int fresh = Camera_GetFrame(frame);
+    int locked = 0;
+    __disable_irq();
+    while (tick_count - ticks < watchdog) {
+        if (Camera_GetFrame(frame)) {
+            locked = 1;
+            break;
+        }
+        __WFI();
+        __enable_irq();
+        __disable_irq();
+    }
+    // Ticks passed waiting for a long exposure belong to this
+    //  iteration, not to an overrun
+    if (tick_count != ticks) {
+        if (locked) {
+            stats.stretched++;
+        }
+        ticks = tick_count;
+    }
+    __enable_irq();
+    last_tick = ticks;
+
+    now = cycle_count();
+    run_dt = (stats.runs != 0) ? (float)(now - run_start) / (float) DEFAULT_SYSTEM_CLOCK \
+                               : SCHEDULER_PERIOD;
+    run_start = now;
+    if (run_start - stamp > stats.latency_max) {
+        stats.latency_max = run_start - stamp;
+    }
+    stats.ticks = ticks;
+    stats.runs++;
+
+    if (!locked) {
+        stats.timeouts++;
+    }
+    if (!(fresh || locked)) {
+        stats.stale_frames++;
+        return 0;
+    }
+    if (run_start - frame->timestamp > stats.age_max) {
+        stats.age_max = run_start - frame->timestamp;
+    }
+    return 1;
+
+} // Scheduler_Wait
+
+/* Scheduler_Dt
+* Description:
+*   Time between the starts of the last two iterations: the
+*   control period, or the frame period while the exposure
+*   stretches it, or longer after an overrun.
+*
+* Parameters:
+*   void
+*
+* Returns:
+*   float - seconds (SCHEDULER_PERIOD on the first iteration)
+*/
+float Scheduler_Dt(void) {
+
+    return run_dt;
+
+} // Scheduler_Dt
+
+/* Scheduler_GetStats
+* Description:
+*   Copies the timing counters
+*
+* Parameters:
+*   stats_out - filled with the counters
+*
+* Returns:
+*   void
+*/
+void Scheduler_GetStats(SchedulerStats* stats_out) {
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    *stats_out = stats;
+    __set_PRIMASK(primask);
+
+} // Scheduler_GetStats
+
+/* Scheduler_ClearStats
+* Description:
+*   Zeroes the timing counters (the overrun check restarts
+*   at the next iteration)
+*
+* Parameters:
+*   void
+*
+* Returns:
+*   void
+*/
+void Scheduler_ClearStats(void) {
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    stats.ticks = tick_count;
+    stats.runs = 0;
+    stats.overruns = 0;
+    stats.missed = 0;
+    stats.stale_frames = 0;
+    stats.timeouts = 0;
+    stats.stretched = 0;
+    stats.age_max = 0;
+    stats.jitter_max = 0;
+    stats.latency_max = 0;
+    stats.busy_max = 0;
+    last_tick = tick_count;
+    __set_PRIMASK(primask);
+
+} // Scheduler_ClearStats
+
+/* Scheduler_Print
+* Description:
+*   Prints the timing counters on UART0
+*
+* Parameters:
+*   void
+*
+* Returns:
+*   void
+*/
+void Scheduler_Print(void) {
+
+    SchedulerStats s;
+    Scheduler_GetStats(&s);
+
+    sprintf(sched_str, "\n\rsched: %lu runs, %lu overruns, %lu missed, %lu stale\n\r", \
+            (unsigned long) s.runs, (unsigned long) s.overruns, \
+            (unsigned long) s.missed, (unsigned long) s.stale_frames);
+    put(sched_str);
+    sprintf(sched_str, "jitter %lu, latency %lu, busy %lu of %lu cycles\n\r", \
+            (unsigned long) s.jitter_max, (unsigned long) s.latency_max, \
+            (unsigned long) s.busy_max, (unsigned long) PERIOD_TICKS);
+    put(sched_str);
+    sprintf(sched_str, "frame age %lu cycles, %lu frame timeouts, %lu stretched\n\r", \
+            (unsigned long) s.age_max, (unsigned long) s.timeouts, \
+            (unsigned long) s.stretched);
+    put(sched_str);
+
+} // Scheduler_Print
@@ -0,0 +1,32 @@
+#ifndef  SCHEDULER_H_
+#define  SCHEDULER_H_
+
+// Control period (seconds), 100 Hz
+#define SCHEDULER_PERIOD    .01f
+
+// Timing counters of the control loop (cycle values in
+// cycle_count() ticks)
+typedef struct {
+    uint32_t ticks;         // control periods elapsed
+    uint32_t runs;          // loop iterations started
+    uint32_t overruns;      // iterations that ran past their period
+    uint32_t missed;        // periods skipped by overruns
+    uint32_t stale_frames;  // iterations without a new camera frame
+    uint32_t timeouts;      // ticks where no frame followed in time
+    uint32_t stretched;     // iterations that waited past the next tick
+                            // for a long exposure frame
+    uint32_t jitter_max;    // largest |tick interval - period|
+    uint32_t latency_max;   // largest tick to iteration start delay
+                            // (includes the wait for the frame)
+    uint32_t age_max;       // largest frame timestamp to iteration start
+    uint32_t busy_max;      // longest iteration
+} SchedulerStats;
+
+void Scheduler_Init(void);
+int Scheduler_Wait(CameraFrame* frame);
+float Scheduler_Dt(void);
+void Scheduler_GetStats(SchedulerStats* stats);
+void Scheduler_ClearStats(void);
+void Scheduler_Print(void);
+void PIT1_IRQHandler(void);
+#endif  /*  ifndef  SCHEDULER_H_  */
@@ -0,0 +1,221 @@
+/*
+ * Closed-loop wheel speed control
+ *
+ * PIT2 runs the inner loop every SPEED_PERIOD, five times
+ * per camera frame. Each tick reads both wheel encoders,
+ * low-pass filters the counts into a speed, and drives
+ * each rear motor with
+ *
+ *   duty = setpoint + PI(setpoint - speed)
+ *
+ * Speeds are in percent of FULL_SPEED (encoder edges per
+ * second at 100% duty on a charged battery), so a setpoint
+ * is the duty that would give it on a full battery. The
+ * setpoint is the feed-forward and the PI only trims it
+ * (by up to SPEED_TRIM): as the battery sags the trim
+ * grows to keep the speed. A zero setpoint switches the
+ * motor off and clears the loop.
+ *
+ * A wheel that reports no counts for STALL_TICKS ticks in a
+ * row while driven at STALL_DUTY or more has a dead (or no)
+ * encoder: its PI would sit at +SPEED_TRIM. The loop then
+ * drops to open loop for both wheels until the next
+ * Speed_Init, so a missing encoder costs at most
+ * SPEED_TRIM duty points for STALL_TICKS ticks.
+ *
+ * With closed_loop off (or after a stall) the setpoint is
+ * driven as the duty directly (open loop, as before the
+ * encoders), and the speeds are still measured.
+ *
+ * File:    speed.c
+ * Authors: Seth Deane & Brian Powers
+ * Created: April 24 2019
+ */
+
+#include "MK64F12.h"
+#include "encoder.h"
+#include "pid.h"
+#include "pwm.h"
+#include "speed.h"
+
+// Default System clock value (PIT clock)
+#define DEFAULT_SYSTEM_CLOCK 20485760u
+
+// Loop period in PIT2 ticks
+#define PERIOD_TICKS        ((uint32_t)(DEFAULT_SYSTEM_CLOCK * SPEED_PERIOD))
+
+// Encoder edges per second at 100% duty (placeholder until
+//  measured on the car, as are the gains below)
+#define FULL_SPEED          20000.0f
+
+// Weight of a new sample in the speed estimate
+#define SPEED_FILTER        0.2f
+
+// PI gains (duty percent per speed percent, ki per second)
+//  and the largest trim of the setpoint
+#define SPEED_KP            0.5f
+#define SPEED_KI            5.0f
+#define SPEED_TRIM          30.0f
+
+// Dead encoder check: duty (percent) that must move the
+//  wheel, and ticks without a count before giving up
+#define STALL_DUTY          30.0f
+#define STALL_TICKS         50
+
+// Motor PWM frequency (as set by main before)
+#define MOTOR_FREQUENCY     10000
+
+static Pid loop[2];
+static volatile float setpoint[2];
+static volatile float measured[2];
+static volatile int closed = 0;
+static int stall_ticks[2];
+
+/* Speed_Init
+* Description:
+*   Starts the encoders and the PIT2 speed loop with the
+*   motors off. Call after init_PIT (which enables the PIT
+*   clock) and init_PWM.
+*
+* Parameters:
+*   closed_loop - 1 to control the speed, 0 to drive the
+*                 setpoint as the duty
+*
+* Returns:
+*   void
+*/
+void Speed_Init(int closed_loop) {
+
+    closed = closed_loop;
+
+    for (int w = 0; w < 2; w++) {
+        Pid_Init(&loop[w], SPEED_KP, SPEED_KI, 0.0f, SPEED_PERIOD, 0.0f, \
+                 -SPEED_TRIM, SPEED_TRIM);
+        setpoint[w] = 0.0f;
+        measured[w] = 0.0f;
+        stall_ticks[w] = 0;
+    }
+
+    Encoder_Init();
+
+    PIT_LDVAL2 = PERIOD_TICKS - 1;
+
+    // Enable timer interrupts
+    PIT_TCTRL2 |= PIT_TCTRL_TIE_MASK;
+
+    // Clear interrupt flag
+    PIT_TFLG2 |= PIT_TFLG_TIF_MASK;
+
+    // Enable the timer
+    PIT_TCTRL2 |= PIT_TCTRL_TEN_MASK;
+
+    // Enable PIT interrupt in the interrupt controller
+    NVIC_EnableIRQ(PIT2_IRQn);
+
+} // Speed_Init
+
+/* Speed_Set
+* Description:
+*   Sets the wheel speed setpoints (picked up by the next
+*   loop tick).
+*
+* Parameters:
+*   left, right - speed (percent of FULL_SPEED, 0 = off)
+*
+* Returns:
+*   void
+*/
+void Speed_Set(float left, float right) {
+
+    setpoint[ENCODER_LEFT] = left;
+    setpoint[ENCODER_RIGHT] = right;
+
+} // Speed_Set
+
+/* Speed_Measured
+* Description:
+*   Filtered wheel speed.
+*
+* Parameters:
+*   wheel - ENCODER_LEFT or ENCODER_RIGHT
+*
+* Returns:
+*   float - speed (percent of FULL_SPEED)
+*/
+float Speed_Measured(int wheel) {
+
+    return measured[wheel];
+
+} // Speed_Measured
+
+/* Speed_ClosedLoop
+* Description:
+*   Whether the speed is controlled (and measured speeds
+*   can be trusted).
+*
+* Parameters:
+*   void
+*
+* Returns:
+*   int - 1 if closed loop, 0 if open loop or an encoder
+*         was found dead
+*/
+int Speed_ClosedLoop(void) {
+
+    return closed;
+
+} // Speed_ClosedLoop
+
+/* PIT2_IRQHandler
+* Description:
+*   Speed loop tick: estimates both wheel speeds and sets
+*   the motor duties.
+*
+* Parameters:
+*   void
+*
+* Returns:
+*   void
+*/
+void PIT2_IRQHandler(void) {
+
+    float duty[2];
+
+    // Clear interrupt
+    PIT_TFLG2 |= PIT_TFLG_TIF_MASK;
+
+    for (int w = 0; w < 2; w++) {
+        int32_t delta = Encoder_Delta(w);
+        float speed = (float) delta * (100.0f / (FULL_SPEED * SPEED_PERIOD));
+        measured[w] += SPEED_FILTER * (speed - measured[w]);
+
+        // Driven hard but not turning: no encoder to close on
+        if (closed && (delta == 0) && (setpoint[w] >= STALL_DUTY)) {
+            if (++stall_ticks[w] >= STALL_TICKS) {
+                closed = 0;
+            }
+        } else {
+            stall_ticks[w] = 0;
+        }
+
+        float set = setpoint[w];
+        if (set <= 0.0f) {
+            Pid_Reset(&loop[w]);
+            duty[w] = 0.0f;
+        } else if (!closed) {
+            duty[w] = set;
+        } else {
+            duty[w] = set + Pid_Update(&loop[w], set - measured[w]);
+        }
+
+        if (duty[w] < 0.0f) {
+            duty[w] = 0.0f;
+        } else if (duty[w] > 100.0f) {
+            duty[w] = 100.0f;
+        }
+    }
+
+    SetMotorDutyCycleL((unsigned int) duty[ENCODER_LEFT], MOTOR_FREQUENCY, 1);
+    SetMotorDutyCycleR((unsigned int) duty[ENCODER_RIGHT], MOTOR_FREQUENCY, 1);
+
+} // PIT2_IRQHandler
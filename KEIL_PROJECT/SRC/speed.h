@@ -0,0 +1,13 @@
+#ifndef SPEED_H_
+#define SPEED_H_
+
+// Inner speed loop period (seconds), PIT2
+#define SPEED_PERIOD    .002f
+
+void Speed_Init(int closed_loop);
+void Speed_Set(float left, float right);
+float Speed_Measured(int wheel);
+int Speed_ClosedLoop(void);
+void PIT2_IRQHandler(void);
+
+#endif /* SPEED_H_ */
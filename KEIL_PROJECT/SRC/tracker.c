@@ -0,0 +1,197 @@
+/*
+ * Kalman tracker for the left and right track edges
+ *
+ * Each edge has a constant velocity state (position and
+ * velocity, in pixels and pixels per frame) with its own
+ * covariance. Every frame the state is predicted forward
+ * and, if the detector found the edge, corrected with the
+ * measurement. A weaker detection (lower weight) gets a
+ * larger measurement noise, so it moves the estimate less.
+ *
+ * Missing edges, and measurements too far from the
+ * prediction (gated out), only run the prediction, so a
+ * bad line never makes the estimate jump. The velocity
+ * decays while coasting, and after TRACK_REACQUIRE missed
+ * frames the next measurement restarts the edge.
+ *
+ * Positions in and out are fixed point with SUBPIXEL_SHIFT
+ * fraction bits (see peak_subpixel), the filter itself
+ * runs in single precision float on the FPU.
+ *
+ * File:    tracker.c
+ * Authors: Seth Deane & Brian Powers
+ * Created: April 14 2019
+ */
+
+#include "MK64F12.h"
+#include "filters.h"
+#include "tracker.h"
+
+// Number of pixels in a line
+#define PIXELS              128
+
+// Process noise per frame (pixels^2, (pixels/frame)^2)
+#define Q_POS               0.05f
+#define Q_VEL               0.02f
+// Measurement noise of a full weight edge (pixels^2)
+#define R_MEAS              0.5f
+// Covariance of a freshly started edge
+#define P_POS_START         16.0f
+#define P_VEL_START         4.0f
+
+// Innovations beyond this many sigma are rejected
+#define GATE_SIGMA          3.0f
+// Velocity kept per frame while coasting
+#define VEL_DECAY           0.8f
+// Missed frames after which any measurement restarts
+#define TRACK_REACQUIRE     5
+
+// State of one edge
+typedef struct {
+    float pos, vel;             // pixels, pixels per frame
+    float p00, p01, p11;        // covariance
+    int missed;                 // frames without an accepted measurement
+} EdgeTrack;
+
+static EdgeTrack tracks[2];
+
+/* Function: track_start
+ * ---------------------
+ *  Starts an edge at pos, at rest.
+ */
+static void track_start(EdgeTrack* t, float pos) {
+    t->pos = pos;
+    t->vel = 0.0f;
+    t->p00 = P_POS_START;
+    t->p01 = 0.0f;
+    t->p11 = P_VEL_START;
+    t->missed = 0;
+}
+
+/* Function: track_step
+ * --------------------
+ *  Predicts an edge one frame ahead and fuses the
+ *  measurement, if there is one and it passes the gate.
+ *
+ *  t: edge state
+ *  z_sub: measured position (SUBPIXEL_SHIFT fixed point)
+ *  weight: detection weight (0..TRACK_WEIGHT_ONE, 0 = none)
+ *
+ *  Returns: void
+ */
+static void track_step(EdgeTrack* t, int32_t z_sub, int weight) {
+    float z = (float) z_sub / (float) (1 << SUBPIXEL_SHIFT);
+
+    if ((weight > 0) && (t->missed >= TRACK_REACQUIRE)) {
+        track_start(t, z);
+        return;
+    }
+
+    // Predict, F = [1 1; 0 1]
+    t->pos += t->vel;
+    t->p00 += 2.0f * t->p01 + t->p11 + Q_POS;
+    t->p01 += t->p11;
+    t->p11 += Q_VEL;
+
+    if (weight > 0) {
+        float r = R_MEAS * (float) TRACK_WEIGHT_ONE / (float) weight;
+        float s = t->p00 + r;
+        float y = z - t->pos;
+
+        if (y * y <= GATE_SIGMA * GATE_SIGMA * s) {
+            // Update, H = [1 0]
+            float k0 = t->p00 / s;
+            float k1 = t->p01 / s;
+            t->pos += k0 * y;
+            t->vel += k1 * y;
+            t->p11 -= k1 * t->p01;
+            t->p01 -= k0 * t->p01;
+            t->p00 -= k0 * t->p00;
+            t->missed = 0;
+            return;
+        }
+    }
+
+    t->vel *= VEL_DECAY;
+    t->missed++;
+}
+
+/* Function: to_sub
+ * ----------------
+ *  Converts a position to fixed point, kept on the line.
+ */
+static int32_t to_sub(float pos) {
+    if (pos < 0.0f) {
+        pos = 0.0f;
+    }
+    if (pos > (float) (PIXELS - 1)) {
+        pos = (float) (PIXELS - 1);
+    }
+    return (int32_t) (pos * (float) (1 << SUBPIXEL_SHIFT) + 0.5f);
+}
+
+/* Function: Tracker_Reset
+ * -----------------------
+ *  Puts both edges at the given positions, marked as
+ *  lost so the first detection of each restarts it.
+ *
+ *  left_sub, right_sub: positions (SUBPIXEL_SHIFT fixed point)
+ *
+ *  Returns: void
+ */
+void Tracker_Reset(int32_t left_sub, int32_t right_sub) {
+    track_start(&tracks[TRACK_LEFT], (float) left_sub / (float) (1 << SUBPIXEL_SHIFT));
+    track_start(&tracks[TRACK_RIGHT], (float) right_sub / (float) (1 << SUBPIXEL_SHIFT));
+    tracks[TRACK_LEFT].missed = TRACK_REACQUIRE;
+    tracks[TRACK_RIGHT].missed = TRACK_REACQUIRE;
+}
+
+/* Function: Tracker_Update
+ * ------------------------
+ *  Advances both edges by one frame.
+ *
+ *  left_sub, right_sub: measured positions (SUBPIXEL_SHIFT
+ *      fixed point), ignored when their weight is 0
+ *  left_weight, right_weight: detection weights
+ *      (0..TRACK_WEIGHT_ONE, 0 = edge not found)
+ *
+ *  Returns: void
+ */
+void Tracker_Update(int32_t left_sub, int left_weight, int32_t right_sub, int right_weight) {
+    track_step(&tracks[TRACK_LEFT], left_sub, left_weight);
+    track_step(&tracks[TRACK_RIGHT], right_sub, right_weight);
+}
+
+/* Function: Tracker_Position
+ * --------------------------
+ *  Estimated position of an edge.
+ *
+ *  edge: TRACK_LEFT or TRACK_RIGHT
+ *
+ *  Returns: position (SUBPIXEL_SHIFT fixed point, 0..127)
+ */
+int32_t Tracker_Position(int edge) {
+    return to_sub(tracks[edge].pos);
+}
+
+/* Function: Tracker_Middle
+ * ------------------------
+ *  Estimated track center, half way between the edges.
+ *
+ *  Returns: center (SUBPIXEL_SHIFT fixed point, 0..127)
+ */
+int32_t Tracker_Middle(void) {
+    return to_sub(0.5f * (tracks[TRACK_LEFT].pos + tracks[TRACK_RIGHT].pos));
+}
+
+/* Function: Tracker_Missed
+ * ------------------------
+ *  Consecutive frames an edge has been predicted only.
+ *
+ *  edge: TRACK_LEFT or TRACK_RIGHT
+ *
+ *  Returns: missed frame count
+ */
+int Tracker_Missed(int edge) {
+    return tracks[edge].missed;
+}
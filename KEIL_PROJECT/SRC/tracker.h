@@ -0,0 +1,16 @@
+#ifndef  TRACKER_H_
+#define  TRACKER_H_
+
+// Edge selectors for Tracker_Position/Tracker_Missed
+#define TRACK_LEFT          0
+#define TRACK_RIGHT         1
+
+// Measurement weight of a full confidence edge (0 = no edge)
+#define TRACK_WEIGHT_ONE    256
+
+void Tracker_Reset(int32_t left_sub, int32_t right_sub);
+void Tracker_Update(int32_t left_sub, int left_weight, int32_t right_sub, int right_weight);
+int32_t Tracker_Position(int edge);
+int32_t Tracker_Middle(void);
+int Tracker_Missed(int edge);
+#endif  /*  ifndef  TRACKER_H_  */
@@ -0,0 +1,169 @@
+/*
+ * Host unit test for the PID controller (pid.c)
+ *
+ * Builds with gcc against the stub CMSIS headers in stub/
+ * (see the Makefile) and prints one line per failed check.
+ *
+ * File:    pid_test.c
+ * Authors: Seth Deane & Brian Powers
+ * Created: April 26 2019
+ */
+
+#include <stdio.h>
+#include "MK64F12.h"
+#include "pid.h"
+
+#define PI_F                3.14159265f
+#define TOLERANCE           1e-4f
+
+static int failures = 0;
+
+/* Function: check_near
+ * --------------------
+ *  Counts a failure if a value is off the expected one.
+ */
+static void check_near(const char* name, float value, float expected) {
+    float diff = value - expected;
+    if ((diff > TOLERANCE) || (diff < -TOLERANCE)) {
+        printf("FAIL %s: %f, expected %f\n", name, value, expected);
+        failures++;
+    }
+}
+
+/* Function: test_output_clamp
+ * ---------------------------
+ *  The output stays within its limits and flags the clamp.
+ */
+static void test_output_clamp(void) {
+    Pid pid;
+    Pid_Init(&pid, 10.0f, 0.0f, 0.0f, 0.01f, 0.0f, -20.0f, 20.0f);
+
+    check_near("clamp high", Pid_Update(&pid, 5.0f), 20.0f);
+    check_near("clamp high saturated", (float) pid.saturated, 1.0f);
+    check_near("clamp low", Pid_Update(&pid, -5.0f), -20.0f);
+    check_near("clamp low saturated", (float) pid.saturated, 1.0f);
+    check_near("clamp inside", Pid_Update(&pid, 1.0f), 10.0f);
+    check_near("clamp inside saturated", (float) pid.saturated, 0.0f);
+}
+
+/* Function: test_conditional_integration
+ * --------------------------------------
+ *  While the output is clamped the integrator only moves
+ *  back out of the clamp.
+ */
+static void test_conditional_integration(void) {
+    Pid pid;
+    // ki dt = 1: each sample integrates the error
+    Pid_Init(&pid, 10.0f, 100.0f, 0.0f, 0.01f, 0.0f, -5.0f, 5.0f);
+
+    // Not clamped yet: integrates once, then the clamp holds it
+    for (int i = 0; i < 10; i++) {
+        Pid_Update(&pid, 1.0f);
+    }
+    check_near("windup held", pid.integrator, 1.0f);
+
+    // An error out of the clamp still integrates
+    check_near("unwind output", Pid_Update(&pid, -0.1f), -0.1f);
+    check_near("unwind integrator", pid.integrator, 0.9f);
+}
+
+/* Function: test_integrator_clamp
+ * -------------------------------
+ *  The integrator stops at its own limits.
+ */
+static void test_integrator_clamp(void) {
+    Pid pid;
+    Pid_Init(&pid, 0.0f, 100.0f, 0.0f, 0.01f, 0.0f, -10.0f, 10.0f);
+    pid.i_min = -2.0f;
+    pid.i_max = 2.0f;
+
+    for (int i = 0; i < 10; i++) {
+        Pid_Update(&pid, 1.0f);
+    }
+    check_near("integrator high", pid.integrator, 2.0f);
+    check_near("integrator high output", pid.out, 2.0f);
+
+    for (int i = 0; i < 10; i++) {
+        Pid_Update(&pid, -1.0f);
+    }
+    check_near("integrator low", pid.integrator, -2.0f);
+}
+
+/* Function: test_first_sample
+ * ---------------------------
+ *  No derivative kick on the first sample after a reset.
+ */
+static void test_first_sample(void) {
+    Pid pid;
+    Pid_Init(&pid, 0.0f, 0.0f, 1.0f, 0.01f, 0.0f, -1000.0f, 1000.0f);
+
+    check_near("first sample", Pid_Update(&pid, 10.0f), 0.0f);
+    check_near("second sample", Pid_Update(&pid, 11.0f), 100.0f);
+
+    Pid_Reset(&pid);
+    check_near("first after reset", Pid_Update(&pid, -30.0f), 0.0f);
+}
+
+/* Function: test_derivative_reset
+ * -------------------------------
+ *  After skipped samples the derivative restarts without a
+ *  kick and the integrator is kept.
+ */
+static void test_derivative_reset(void) {
+    Pid pid;
+    Pid_Init(&pid, 0.0f, 100.0f, 1.0f, 0.01f, 10.0f, -1000.0f, 1000.0f);
+
+    Pid_Update(&pid, 0.0f);
+    Pid_Update(&pid, 1.0f);
+    float integrator = pid.integrator;
+
+    Pid_ResetDerivative(&pid);
+    check_near("derivative cleared", pid.derivative, 0.0f);
+    check_near("integrator kept", pid.integrator, integrator);
+    check_near("no kick after gap", Pid_Update(&pid, 20.0f), integrator + 20.0f);
+}
+
+/* Function: test_derivative_filter
+ * --------------------------------
+ *  The derivative follows a first order low-pass with the
+ *  cutoff, also after the sample time changes.
+ */
+static void test_derivative_filter(void) {
+    Pid pid;
+    float dt = 0.01f;
+    float tau = 1.0f / (2.0f * PI_F * 10.0f);
+    float alpha = tau / (tau + dt);
+    Pid_Init(&pid, 0.0f, 0.0f, 1.0f, dt, 10.0f, -1000.0f, 1000.0f);
+
+    // Error step of 1: raw derivative 100, filtered part of it
+    Pid_Update(&pid, 0.0f);
+    float d1 = Pid_Update(&pid, 1.0f);
+    check_near("step response", d1, (1.0f - alpha) * 100.0f);
+
+    // Then it decays with no new change
+    float d2 = Pid_Update(&pid, 1.0f);
+    check_near("decay", d2, alpha * d1);
+
+    // A longer sample time keeps the cutoff
+    Pid_SetDt(&pid, 2.0f * dt);
+    check_near("new alpha", pid.d_alpha, tau / (tau + 2.0f * dt));
+    float d3 = Pid_Update(&pid, 2.0f);
+    check_near("step after dt change", d3, \
+               pid.d_alpha * d2 + (1.0f - pid.d_alpha) * 50.0f);
+}
+
+int main(void) {
+    test_output_clamp();
+    test_conditional_integration();
+    test_integrator_clamp();
+    test_first_sample();
+    test_derivative_reset();
+    test_derivative_filter();
+
+    if (failures != 0) {
+        printf("pid_test: %d failed\n", failures);
+        return 1;
+    }
+    printf("pid_test: passed\n");
+    return 0;
+}
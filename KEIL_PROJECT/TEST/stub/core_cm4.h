@@ -0,0 +1,20 @@
+/*
+ * Host build stand-in for the CMSIS core header, enough for
+ * MK64F12.h to compile with gcc (register access qualifiers
+ * only, no core functions).
+ *
+ * File:    core_cm4.h
+ * Authors: Seth Deane & Brian Powers
+ * Created: April 26 2019
+ */
+
+#ifndef CORE_CM4_H_
+#define CORE_CM4_H_
+
+#include <stdint.h>
+
+#define __I     volatile const
+#define __O     volatile
+#define __IO    volatile
+
+#endif /* CORE_CM4_H_ */
@@ -0,0 +1,13 @@
+/*
+ * Host build stand-in for the system header (nothing the
+ * tested modules use).
+ *
+ * File:    system_MK64F12.h
+ * Authors: Seth Deane & Brian Powers
+ * Created: April 26 2019
+ */
+
+#ifndef SYSTEM_MK64F12_H_
+#define SYSTEM_MK64F12_H_
+
+#endif /* SYSTEM_MK64F12_H_ */